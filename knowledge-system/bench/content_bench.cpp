@@ -0,0 +1,74 @@
+#include "content_store.h"
+#include <chrono>
+#include <cstdlib>
+
+/*
+ * compression ratio and decode throughput of the content store on templated
+ * bodies like the ones main.cpp generates, with a share of exact duplicates.
+ * usage: content_bench [documents]
+ */
+int main(int argc, char** argv)
+{
+    uint64_t docs = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    content_store store;
+    std::vector<uint32_t> handles;
+    uint64_t seed = 42;
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < docs; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        // a quarter of the bodies repeat an earlier one word for word
+        uint64_t id = (seed >> 33) % 4 == 0 ? (seed >> 35) % (i + 1) : i;
+        handles.push_back(store.put(
+            "Content for document " + std::to_string(id)
+            + "\nStatus: reviewed\nOwner: team-" + std::to_string(id % 16)
+            + "\nSummary: this document follows the standard template."));
+    }
+    std::chrono::duration<double> put_took =
+        std::chrono::steady_clock::now() - start;
+
+    // in id order, neighbours share a block, so the lru absorbs most reads
+    uint64_t decoded = 0;
+    start = std::chrono::steady_clock::now();
+    for(uint32_t handle : handles) { decoded += store.get(handle).size(); }
+    std::chrono::duration<double> seq_took =
+        std::chrono::steady_clock::now() - start;
+
+    // every sealed block once, straight through the codec
+    uint64_t raw = 0;
+    uint64_t blocks = 0;
+    std::string block;
+    for(uint64_t i = 0; i < 4096; i++) {
+        block += "Content for document " + std::to_string(i)
+                 + "\nStatus: reviewed\nOwner: team-"
+                 + std::to_string(i % 16)
+                 + "\nSummary: this document follows the standard template.";
+    }
+    std::vector<uint8_t> packed = content_store::compress(block);
+    start = std::chrono::steady_clock::now();
+    while(raw < (1ULL << 30)) {
+        raw += content_store::decompress(packed, block.size()).size();
+        blocks++;
+    }
+    std::chrono::duration<double> codec_took =
+        std::chrono::steady_clock::now() - start;
+
+    double mb = 1024.0 * 1024.0;
+    std::cout << "documents\t" << docs << "\n"
+              << "logical_bytes\t" << store.get_logical_bytes() << "\n"
+              << "unique_bytes\t" << store.get_unique_bytes() << "\n"
+              << "stored_bytes\t" << store.get_stored_bytes() << "\n"
+              << "dedup_ratio\t"
+              << double(store.get_logical_bytes()) / store.get_unique_bytes()
+              << "\n"
+              << "total_ratio\t"
+              << double(store.get_logical_bytes()) / store.get_stored_bytes()
+              << "\n"
+              << "block_ratio\t" << double(block.size()) / packed.size() << "\n"
+              << "put_docs_per_sec\t" << uint64_t(docs / put_took.count())
+              << "\n"
+              << "get_mb_per_sec\t" << decoded / mb / seq_took.count() << "\n"
+              << "decode_mb_per_sec\t" << raw / mb / codec_took.count()
+              << std::endl;
+    return 0;
+}
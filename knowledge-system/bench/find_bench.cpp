@@ -0,0 +1,70 @@
+#include "sys.h"
+#include "workload.h"
+#include <chrono>
+#include <cstdlib>
+
+/*
+ * avl_tree::find_batch against a loop of single find calls on a tree far
+ * larger than the last level cache. ids are inserted in random order so
+ * neighbouring nodes do not share cache lines, and a tenth of the lookups
+ * miss.
+ * usage: find_bench [documents] [lookups]
+ */
+int main(int argc, char** argv)
+{
+    uint64_t docs = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    uint64_t lookups =
+        argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4000000;
+
+    workload_rng rng(11);
+    std::vector<uint64_t> order(docs);
+    for(uint64_t i = 0; i < docs; i++) { order[i] = i; }
+    for(uint64_t i = docs - 1; i > 0; i--) {
+        std::swap(order[i], order[rng.below(i + 1)]);
+    }
+    avl_tree tree;
+    std::vector<document*> owned;
+    for(uint64_t i : order) {
+        // even ids only, so odd ones are guaranteed misses
+        owned.push_back(new document(2 * i, ""));
+        tree.insert(owned.back());
+    }
+
+    std::vector<uint64_t> ids(lookups);
+    for(uint64_t& id : ids) {
+        id = 2 * rng.below(docs) + (rng.below(10) == 0 ? 1 : 0);
+    }
+    std::vector<document*> out(lookups);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < lookups; i++) { out[i] = tree.find(ids[i]); }
+    std::chrono::duration<double, std::nano> took =
+        std::chrono::steady_clock::now() - start;
+    double single_ns = took.count() / lookups;
+    uint64_t hits = 0;
+    for(document* doc : out) { hits += doc != nullptr; }
+
+    std::cout << "# find_bench documents=" << docs << " lookups=" << lookups
+              << " hits=" << hits << "\n"
+              << "batch\tns_per_lookup\tspeedup\n"
+              << "single\t" << single_ns << "\t1" << std::endl;
+    for(uint64_t batch = 16; batch <= 4096; batch *= 4) {
+        std::vector<document*> batched(lookups);
+        start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < lookups; i += batch) {
+            tree.find_batch(ids.data() + i, std::min(batch, lookups - i),
+                            batched.data() + i);
+        }
+        took = std::chrono::steady_clock::now() - start;
+        if(batched != out) {
+            std::cerr << "find_batch disagrees with find" << std::endl;
+            return 1;
+        }
+        double batch_ns = took.count() / lookups;
+        std::cout << batch << "\t" << batch_ns << "\t" << single_ns / batch_ns
+                  << std::endl;
+    }
+
+    for(document* doc : owned) { delete doc; }
+    return 0;
+}
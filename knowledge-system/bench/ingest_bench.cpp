@@ -0,0 +1,55 @@
+#include "document_store.h"
+#include <chrono>
+#include <cstdlib>
+
+/*
+ * document_store batch ingest throughput for 1, 2, 4, ... workers, and
+ * the same documents inserted one at a time.
+ * usage: ingest_bench [documents] [batch size]
+ */
+int main(int argc, char** argv)
+{
+    uint64_t docs = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    uint64_t batch_size =
+        argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000;
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::vector<document_store::raw_document>> batches;
+    for(uint64_t i = 0; i < docs; i++) {
+        if(i % batch_size == 0) { batches.emplace_back(); }
+        document_store::raw_document raw;
+        raw.id = i;
+        raw.priority = i % 20;
+        raw.content = "Content for document " + std::to_string(i)
+                      + " filed under topic " + std::to_string(i % 97)
+                      + " and reviewed by team " + std::to_string(i % 13);
+        raw.tags.push_back("all_docs");
+        raw.tags.push_back("topic_" + std::to_string(i % 97));
+        if(i > 0) { raw.refs.push_back(i / 2); }
+        batches.back().push_back(raw);
+    }
+
+    std::cout << "workers\tdocuments\tdocs_per_sec\tsingle_inserts_per_sec"
+              << std::endl;
+    for(uint32_t workers = 1; workers <= cores; workers *= 2) {
+        document_store store(workers);
+        auto start = std::chrono::steady_clock::now();
+        store.ingest(batches);
+        std::chrono::duration<double> took =
+            std::chrono::steady_clock::now() - start;
+
+        document_store single(workers);
+        start = std::chrono::steady_clock::now();
+        for(const std::vector<document_store::raw_document>& batch : batches) {
+            for(const document_store::raw_document& raw : batch) {
+                single.insert(raw);
+            }
+        }
+        std::chrono::duration<double> single_took =
+            std::chrono::steady_clock::now() - start;
+        std::cout << workers << "\t" << store.size() << "\t"
+                  << uint64_t(docs / took.count()) << "\t"
+                  << uint64_t(docs / single_took.count()) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,536 @@
+#include "content_store.h"
+#include "document_store.h"
+#include "fulltext.h"
+#include "sys.h"
+#include "tag_index.h"
+#include "workload.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+/*
+ * throughput, latency quantiles and peak memory of every knowledge-system
+ * structure under a configurable, seeded workload.
+ *
+ * usage: ks_bench [--docs=N] [--ops=N] [--tags=N] [--zipf=THETA]
+ *                 [--graph=power_law|chain|scc] [--edges=N]
+ *                 [--graph-nodes=N] [--read-ratio=R] [--searches=N]
+ *                 [--seed=N]
+ *
+ * the report is tab separated, one row per structure and operation in a
+ * fixed order, so two runs can be compared with diff or a spreadsheet.
+ * every structure gets a "mixed" row of reads and writes at --read-ratio.
+ * rows whose reads return whole lists (searches, backlinks) and removals
+ * that are linear in a list run --searches operations, the rest --ops.
+ * keys, handles, queries, bodies and the read / write choices of the mixed
+ * rows are all drawn before a row starts, so the timed calls do nothing but
+ * index them and run the operation itself.
+ * --graph-nodes defaults to --docs but at most 100000, see max_graph_nodes.
+ * peak_mem_kb is how far resident memory rose above where it stood when the
+ * structure's phase began, so every structure is charged for itself only.
+ */
+
+/*
+ * knowledge_graph hashes its nodes into 1009 fixed buckets, so every
+ * add_reference walks about nodes / 1009 entries. past this many nodes the
+ * graph phase takes hours, a larger --graph-nodes has to be asked for.
+ */
+static const uint64_t max_graph_nodes = 100000;
+
+struct bench_config {
+    uint64_t docs = 100000;
+    uint64_t ops = 1000000; // point operations per phase
+    uint64_t tags = 1000; // distinct tags
+    double zipf = 0.99; // skew of id and tag popularity, 0 is uniform
+    graph_shape shape = graph_shape::power_law;
+    std::string shape_name = "power_law";
+    uint64_t edges = 4; // references per document
+    uint64_t graph_nodes = 0; // 0 means --docs, capped at max_graph_nodes
+    double read_ratio = 0.9; // share of reads in the mixed phases
+    uint64_t searches = 1000; // for ops that return whole lists
+    uint64_t seed = 1;
+};
+
+static bool parse_args(int argc, char** argv, bench_config& config)
+{
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        uint64_t eq = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            return false;
+        }
+        std::string key = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if(key == "docs") { config.docs = std::stoull(value); }
+        else if(key == "ops") {
+            config.ops = std::stoull(value);
+        }
+        else if(key == "tags") {
+            config.tags = std::stoull(value);
+        }
+        else if(key == "zipf") {
+            config.zipf = std::stod(value);
+        }
+        else if(key == "graph") {
+            if(!parse_graph_shape(value, config.shape)) { return false; }
+            config.shape_name = value;
+        }
+        else if(key == "edges") {
+            config.edges = std::stoull(value);
+        }
+        else if(key == "graph-nodes") {
+            config.graph_nodes = std::stoull(value);
+        }
+        else if(key == "read-ratio") {
+            config.read_ratio = std::stod(value);
+        }
+        else if(key == "searches") {
+            config.searches = std::stoull(value);
+        }
+        else if(key == "seed") {
+            config.seed = std::stoull(value);
+        }
+        else {
+            return false;
+        }
+    }
+    if(config.graph_nodes == 0) {
+        config.graph_nodes = std::min(config.docs, max_graph_nodes);
+    }
+    return config.docs > 0 && config.tags > 0;
+}
+
+/* a field of /proc/self/status in kB, VmRSS or VmHWM */
+static uint64_t status_kb(const char* field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    uint64_t length = std::strlen(field);
+    while(std::getline(status, line)) {
+        if(line.compare(0, length, field) == 0 && line[length] == ':') {
+            return std::strtoull(line.c_str() + length + 1, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+static uint64_t baseline_kb = 0;
+
+/*
+ * starts a structure's phase. writing 5 to clear_refs resets VmHWM to the
+ * current rss, where that is not allowed the peak stays process wide.
+ */
+static void begin_phase()
+{
+    std::ofstream("/proc/self/clear_refs") << "5";
+    baseline_kb = status_kb("VmRSS");
+}
+
+static uint64_t peak_mem_kb()
+{
+    uint64_t peak = status_kb("VmHWM");
+    return peak > baseline_kb ? peak - baseline_kb : 0;
+}
+
+/* n values of pick(), drawn before a row so its timed calls only index */
+template <typename F>
+static std::vector<uint64_t> draw(uint64_t n, F pick)
+{
+    std::vector<uint64_t> ret_vec;
+    ret_vec.reserve(n);
+    for(uint64_t i = 0; i < n; i++) { ret_vec.push_back(pick()); }
+    return ret_vec;
+}
+
+/*
+ * times body(i) for i in [0, n) one call at a time and prints one report
+ * row with the throughput and latency quantiles of those calls.
+ */
+template <typename F>
+static void run(const char* structure, const char* op, uint64_t n, F body)
+{
+    std::vector<uint64_t> hist(ks_histogram::bucket_count, 0);
+    auto begin = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < n; i++) {
+        auto start = std::chrono::steady_clock::now();
+        body(i);
+        std::chrono::nanoseconds took =
+            std::chrono::steady_clock::now() - start;
+        hist[ks_histogram::bucket_of(took.count())]++;
+    }
+    std::chrono::duration<double> total =
+        std::chrono::steady_clock::now() - begin;
+
+    auto quantile = [&](double q) {
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * n));
+        uint64_t seen = 0;
+        for(uint32_t b = 0; b < ks_histogram::bucket_count; b++) {
+            seen += hist[b];
+            if(seen >= rank) { return ks_histogram::upper_of(b); }
+        }
+        return uint64_t(0);
+    };
+    std::cout << structure << "\t" << op << "\t" << n << "\t"
+              << (n == 0 ? 0 : static_cast<uint64_t>(n / total.count()))
+              << "\t" << (n == 0 ? 0 : quantile(0.5)) << "\t"
+              << (n == 0 ? 0 : quantile(0.99)) << "\t"
+              << (n == 0 ? 0 : quantile(0.999)) << "\t" << peak_mem_kb()
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    bench_config config;
+    if(!parse_args(argc, argv, config)) {
+        std::cerr << "usage: ks_bench [--docs=N] [--ops=N] [--tags=N] "
+                     "[--zipf=THETA] [--graph=power_law|chain|scc] "
+                     "[--edges=N] [--graph-nodes=N] [--read-ratio=R] "
+                     "[--searches=N] [--seed=N]\n"
+                     "--graph-nodes defaults to --docs, capped at "
+                  << max_graph_nodes
+                  << " (knowledge_graph has 1009 fixed buckets)" << std::endl;
+        return 1;
+    }
+
+    std::cout << "# ks_bench docs=" << config.docs << " ops=" << config.ops
+              << " tags=" << config.tags << " zipf=" << config.zipf
+              << " graph=" << config.shape_name << " edges=" << config.edges
+              << " graph_nodes=" << config.graph_nodes
+              << " read_ratio=" << config.read_ratio
+              << " searches=" << config.searches << " seed=" << config.seed
+              << "\n"
+              << "structure\toperation\tops\tops_per_sec\tp50_ns\tp99_ns\t"
+                 "p999_ns\tpeak_mem_kb"
+              << std::endl;
+
+    workload_rng rng(config.seed);
+    zipf_sampler doc_pick(config.docs, config.zipf);
+    zipf_sampler tag_pick(config.tags, config.zipf);
+
+    // every tag is interned up front, searches then take the symbol. symbols
+    // past the last interned one are in no index at all
+    std::vector<std::string> tag_names;
+    std::vector<uint32_t> tag_symbols;
+    for(uint64_t t = 0; t < config.tags; t++) {
+        tag_names.push_back("tag_" + std::to_string(t));
+        tag_symbols.push_back(tag_interner::global().intern(tag_names.back()));
+    }
+    uint32_t first_missing = tag_interner::global().size();
+
+    // ids are scattered with an odd multiplier (a bijection on uint64_t),
+    // so the popular ranks are not neighbours in the tree
+    std::vector<document*> docs;
+    docs.reserve(config.docs);
+    for(uint64_t i = 0; i < config.docs; i++) {
+        uint64_t id = i * 0x9E3779B97F4A7C15ULL;
+        document* doc = new document(id, "");
+        doc->priority = static_cast<uint8_t>(rng.below(256));
+        uint64_t tag_count = 1 + rng.below(3);
+        for(uint64_t t = 0; t < tag_count; t++) {
+            doc->add_tag(tag_names[tag_pick.next(rng)]);
+        }
+        docs.push_back(doc);
+    }
+    // the (document, tag) pairs the tag indexes are filled with
+    std::vector<std::pair<uint32_t, document*>> tagged;
+    for(document* doc : docs) {
+        for(uint32_t symbol : doc->tags) {
+            tagged.push_back(std::make_pair(symbol, doc));
+        }
+    }
+    // document bodies, drawn from a zipfian vocabulary
+    zipf_sampler word_pick(50000, config.zipf);
+    std::vector<std::string> bodies;
+    bodies.reserve(config.docs);
+    for(uint64_t i = 0; i < config.docs; i++) {
+        std::string body = "content for document " + std::to_string(i);
+        for(int w = 0; w < 16; w++) {
+            body += " w" + std::to_string(word_pick.next(rng));
+        }
+        bodies.push_back(body);
+    }
+    std::vector<std::string> queries;
+    for(uint64_t i = 0; i < config.searches; i++) {
+        queries.push_back("w" + std::to_string(word_pick.next(rng)) + " w"
+                          + std::to_string(word_pick.next(rng)));
+    }
+    op_mix mix(config.read_ratio);
+    auto doc_ids = [&] { return docs[doc_pick.next(rng)]->id; };
+    auto doc_ranks = [&] { return doc_pick.next(rng); };
+    auto tag_ranks = [&] { return tag_pick.next(rng); };
+    auto reads = [&] { return mix.is_read(rng); };
+
+    {
+        begin_phase();
+        avl_tree tree;
+        std::vector<bool> present(config.docs, true);
+        run("avl_tree", "insert", config.docs,
+            [&](uint64_t i) { tree.insert(docs[i]); });
+        std::vector<uint64_t> ids = draw(config.ops, doc_ids);
+        run("avl_tree", "find", config.ops,
+            [&](uint64_t i) { tree.find(ids[i]); });
+        std::vector<uint64_t> picks = draw(config.ops, doc_ranks);
+        std::vector<uint64_t> is_read = draw(config.ops, reads);
+        for(uint64_t i = 0; i < config.ops; i++) {
+            ids[i] = docs[picks[i]]->id;
+        }
+        run("avl_tree", "mixed", config.ops, [&](uint64_t i) {
+            uint64_t pick = picks[i];
+            if(is_read[i]) { tree.find(ids[i]); }
+            else if(present[pick]) {
+                tree.remove(ids[i]);
+                present[pick] = false;
+            }
+            else {
+                tree.insert(docs[pick]);
+                present[pick] = true;
+            }
+        });
+        for(uint64_t i = 0; i < config.docs; i++) {
+            if(!present[i]) { tree.insert(docs[i]); }
+        }
+        run("avl_tree", "remove", config.docs,
+            [&](uint64_t i) { tree.remove(docs[i]->id); });
+    }
+
+    // the hash_table and tag_index phases run the same rows
+    auto tag_rows = [&](const char* structure, auto& tags) {
+        std::vector<bool> present(tagged.size(), true);
+        run(structure, "insert", tagged.size(), [&](uint64_t i) {
+            tags.insert(tagged[i].first, tagged[i].second);
+        });
+        std::vector<uint64_t> symbols = draw(config.searches, [&] {
+            return tag_symbols[tag_pick.next(rng)];
+        });
+        run(structure, "search", config.searches, [&](uint64_t i) {
+            tags.search(static_cast<uint32_t>(symbols[i]));
+        });
+        run(structure, "search_missing", config.ops, [&](uint64_t i) {
+            tags.search(first_missing + static_cast<uint32_t>(i % 1024));
+        });
+        symbols = draw(config.searches,
+                       [&] { return tag_symbols[tag_pick.next(rng)]; });
+        std::vector<uint64_t> is_read = draw(config.searches, reads);
+        std::vector<uint64_t> picks = draw(config.searches, [&] {
+            return rng.below(tagged.size());
+        });
+        run(structure, "mixed", config.searches, [&](uint64_t i) {
+            if(is_read[i]) {
+                tags.search(static_cast<uint32_t>(symbols[i]));
+                return;
+            }
+            uint64_t pick = picks[i];
+            if(present[pick]) {
+                tags.remove(tagged[pick].first, tagged[pick].second);
+            }
+            else {
+                tags.insert(tagged[pick].first, tagged[pick].second);
+            }
+            present[pick] = !present[pick];
+        });
+        picks = draw(config.searches, [&] { return rng.below(tagged.size()); });
+        run(structure, "remove", config.searches, [&](uint64_t i) {
+            tags.remove(tagged[picks[i]].first, tagged[picks[i]].second);
+        });
+    };
+    {
+        begin_phase();
+        hash_table tags;
+        tag_rows("hash_table", tags);
+    }
+    {
+        begin_phase();
+        tag_index tags;
+        tag_rows("tag_index", tags);
+    }
+
+    {
+        begin_phase();
+        priority_queue pq;
+        run("priority_queue", "add_new_task", config.docs,
+            [&](uint64_t i) { pq.add_new_task(docs[i]); });
+        // a read takes the next task, a write queues one that was taken
+        std::vector<document*> taken;
+        taken.reserve(config.docs);
+        std::vector<uint64_t> is_read = draw(config.ops, reads);
+        run("priority_queue", "mixed", config.ops, [&](uint64_t i) {
+            if(is_read[i] || taken.empty()) {
+                document* doc = pq.get_next_task();
+                if(doc != nullptr) { taken.push_back(doc); }
+            }
+            else {
+                pq.add_new_task(taken.back());
+                taken.pop_back();
+            }
+        });
+        for(document* doc : taken) { pq.add_new_task(doc); }
+        std::vector<document*> victims;
+        for(uint64_t i = 0; i < config.searches; i++) {
+            victims.push_back(docs[rng.below(config.docs)]);
+        }
+        run("priority_queue", "remove", config.searches,
+            [&](uint64_t i) { pq.remove(victims[i]); });
+        run("priority_queue", "get_next_task", config.docs,
+            [&](uint64_t) { pq.get_next_task(); });
+    }
+
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> edges =
+            make_graph(config.shape, config.graph_nodes, config.edges, rng);
+        zipf_sampler node_pick(config.graph_nodes, config.zipf);
+        auto popular = [&] { return node_pick.next(rng); };
+        auto any = [&] { return rng.below(config.graph_nodes); };
+        std::vector<uint64_t> targets = draw(config.searches, popular);
+        std::vector<uint64_t> sources = draw(config.searches, any);
+        std::vector<uint64_t> ends = draw(config.searches, any);
+        std::vector<uint64_t> is_read = draw(config.searches, reads);
+        std::vector<uint64_t> citing = draw(config.searches, any);
+        std::vector<uint64_t> cited = draw(config.searches, popular);
+        std::vector<uint64_t> dropped = draw(config.searches, any);
+        begin_phase();
+        knowledge_graph graph;
+        run("knowledge_graph", "add_reference", edges.size(), [&](uint64_t i) {
+            graph.add_reference(edges[i].first, edges[i].second);
+        });
+        run("knowledge_graph", "get_backlinks", config.searches,
+            [&](uint64_t i) { graph.get_backlinks(targets[i]); });
+        run("knowledge_graph", "is_reachable", config.searches,
+            [&](uint64_t i) { graph.is_reachable(sources[i], ends[i]); });
+        // writes cite popular documents, as new references mostly do
+        run("knowledge_graph", "mixed", config.searches, [&](uint64_t i) {
+            if(is_read[i]) { graph.get_backlinks(cited[i]); }
+            else { graph.add_reference(citing[i], cited[i]); }
+        });
+        run("knowledge_graph", "remove_document", config.searches,
+            [&](uint64_t i) { graph.remove_document(dropped[i]); });
+    }
+
+    {
+        begin_phase();
+        fulltext_index text;
+        std::vector<bool> present(config.docs, true);
+        run("fulltext_index", "add", config.docs, [&](uint64_t i) {
+            text.add(docs[i], fulltext_index::analyze(bodies[i]));
+        });
+        run("fulltext_index", "search", config.searches,
+            [&](uint64_t i) { text.search(queries[i], 10); });
+        std::vector<uint64_t> is_read = draw(config.searches, reads);
+        std::vector<uint64_t> picks = draw(config.searches, doc_ranks);
+        run("fulltext_index", "mixed", config.searches, [&](uint64_t i) {
+            if(is_read[i]) {
+                text.search(queries[i], 10);
+                return;
+            }
+            uint64_t pick = picks[i];
+            if(present[pick]) { text.remove(docs[pick]); }
+            else {
+                text.add(docs[pick], fulltext_index::analyze(bodies[pick]));
+            }
+            present[pick] = !present[pick];
+        });
+        run("fulltext_index", "remove", config.docs,
+            [&](uint64_t i) { text.remove(docs[i]); });
+    }
+
+    {
+        begin_phase();
+        content_store contents;
+        // popular documents are the ones stored again as copies
+        std::vector<uint32_t> handles(config.docs);
+        std::vector<uint64_t> picks = draw(config.docs, doc_ranks);
+        run("content_store", "put", config.docs, [&](uint64_t i) {
+            handles[i] = contents.put(bodies[picks[i]]);
+        });
+        std::vector<uint64_t> gets = draw(config.ops, [&] {
+            return handles[doc_pick.next(rng)];
+        });
+        run("content_store", "get", config.ops, [&](uint64_t i) {
+            contents.get(static_cast<uint32_t>(gets[i]));
+        });
+        // a mixed write replaces the handle, so reads look theirs up late
+        std::vector<bool> present(config.docs, true);
+        std::vector<uint64_t> is_read = draw(config.ops, reads);
+        picks = draw(config.ops, doc_ranks);
+        run("content_store", "mixed", config.ops, [&](uint64_t i) {
+            uint64_t pick = picks[i];
+            if(is_read[i]) {
+                if(present[pick]) { contents.get(handles[pick]); }
+                return;
+            }
+            if(present[pick]) { contents.release(handles[pick]); }
+            else { handles[pick] = contents.put(bodies[pick]); }
+            present[pick] = !present[pick];
+        });
+        run("content_store", "release", config.docs, [&](uint64_t i) {
+            if(present[i]) { contents.release(handles[i]); }
+        });
+    }
+
+    {
+        // the store owns its documents, so it gets copies of the raw input
+        std::vector<document_store::raw_document> raws(config.docs);
+        for(uint64_t i = 0; i < config.docs; i++) {
+            raws[i].id = docs[i]->id;
+            raws[i].priority = docs[i]->priority;
+            raws[i].content = bodies[i];
+            for(uint32_t t = 0; t < docs[i]->tags.size(); t++) {
+                raws[i].tags.push_back(docs[i]->tag_name(t));
+            }
+            raws[i].refs.push_back(docs[doc_pick.next(rng)]->id);
+        }
+        const uint64_t batch_size = 1000;
+        std::vector<std::vector<document_store::raw_document>> batches;
+        for(uint64_t i = 0; i < config.docs; i++) {
+            if(i % batch_size == 0) { batches.emplace_back(); }
+            batches.back().push_back(raws[i]);
+        }
+        std::vector<document_store::raw_document> singles = raws;
+        std::vector<uint64_t> ids = draw(config.ops, doc_ids);
+        std::vector<uint64_t> tag_picks = draw(config.searches, tag_ranks);
+        std::vector<uint64_t> is_read = draw(config.searches, reads);
+        std::vector<uint64_t> picks = draw(config.searches, doc_ranks);
+        std::vector<uint64_t> pick_ids(config.searches);
+        for(uint64_t i = 0; i < config.searches; i++) {
+            pick_ids[i] = docs[picks[i]]->id;
+        }
+        std::vector<uint64_t> removed_ids = draw(config.searches, [&] {
+            return docs[rng.below(config.docs)]->id;
+        });
+        begin_phase();
+        {
+            document_store store;
+            run("document_store", "insert", config.docs, [&](uint64_t i) {
+                store.insert(std::move(singles[i]));
+            });
+        }
+        document_store store;
+        // one op is one batch of batch_size documents
+        run("document_store", "ingest_batch", batches.size(),
+            [&](uint64_t i) { store.ingest(std::move(batches[i])); });
+        run("document_store", "find", config.ops,
+            [&](uint64_t i) { store.find(ids[i]); });
+        run("document_store", "search_tag", config.searches, [&](uint64_t i) {
+            store.search_tag(tag_names[tag_picks[i]]);
+        });
+        run("document_store", "search_text", config.searches,
+            [&](uint64_t i) { store.search_text(queries[i], 10); });
+        // a reinsert copies its raw document, which is part of the api cost
+        std::vector<bool> present(config.docs, true);
+        run("document_store", "mixed", config.searches, [&](uint64_t i) {
+            uint64_t pick = picks[i];
+            if(is_read[i]) {
+                store.find(pick_ids[i]);
+                return;
+            }
+            if(present[pick]) { store.remove(pick_ids[i]); }
+            else { store.insert(raws[pick]); }
+            present[pick] = !present[pick];
+        });
+        run("document_store", "remove", config.searches,
+            [&](uint64_t i) { store.remove(removed_ids[i]); });
+    }
+
+    for(document* doc : docs) { delete doc; }
+    return 0;
+}
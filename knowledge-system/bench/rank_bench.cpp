@@ -0,0 +1,81 @@
+#include "rank.h"
+#include "workload.h"
+#include <chrono>
+#include <cstdlib>
+
+/*
+ * page_rank on a power law reference graph: a full compute for 1, 2, 4, ...
+ * workers, then batches of new references folded in with update(), which
+ * pushes residuals through the part of the graph they reach, against a full
+ * recompute of the same graph. max_rank_error is the largest difference
+ * between the two rankings of any document.
+ * usage: rank_bench [documents] [references per document] [batch size]
+ */
+int main(int argc, char** argv)
+{
+    uint64_t nodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    uint64_t per_node = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    uint64_t batch_size =
+        argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1000;
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    workload_rng rng(3);
+    knowledge_graph graph;
+    for(const std::pair<uint64_t, uint64_t>& edge :
+        make_graph(graph_shape::power_law, nodes, per_node, rng)) {
+        graph.add_reference(edge.first, edge.second);
+    }
+
+    std::cout << "# rank_bench documents=" << nodes
+              << " references_per_document=" << per_node
+              << " batch=" << batch_size << " cores=" << cores << "\n"
+              << "workers\tpasses\tcompute_ms" << std::endl;
+    for(uint32_t workers = 1; workers <= cores; workers *= 2) {
+        page_rank rank(workers);
+        auto start = std::chrono::steady_clock::now();
+        uint32_t passes = rank.compute(graph);
+        std::chrono::duration<double, std::milli> took =
+            std::chrono::steady_clock::now() - start;
+        std::cout << workers << "\t" << passes << "\t" << took.count()
+                  << std::endl;
+    }
+
+    std::cout << "batch\tupdate_pushes\tupdate_ms\tfull_passes\tfull_ms\t"
+                 "max_rank_error"
+              << std::endl;
+    page_rank incremental(cores);
+    incremental.compute(graph);
+    for(uint32_t round = 1; round <= 3; round++) {
+        // new documents citing the existing ones, mostly the popular ones
+        std::vector<std::pair<uint64_t, uint64_t>> batch;
+        zipf_sampler cited(nodes, 0.99);
+        for(uint64_t i = 0; i < batch_size; i++) {
+            batch.push_back(std::make_pair(nodes + rng.below(batch_size),
+                                           cited.next(rng)));
+        }
+        nodes += batch_size;
+        for(const std::pair<uint64_t, uint64_t>& edge : batch) {
+            graph.add_reference(edge.first, edge.second);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t update_pushes = incremental.update(batch);
+        std::chrono::duration<double, std::milli> update_took =
+            std::chrono::steady_clock::now() - start;
+
+        page_rank full(cores);
+        start = std::chrono::steady_clock::now();
+        uint32_t full_passes = full.compute(graph);
+        std::chrono::duration<double, std::milli> full_took =
+            std::chrono::steady_clock::now() - start;
+        double error = 0;
+        for(const std::pair<uint64_t, double>& entry : full.top(full.size())) {
+            double off = entry.second - incremental.rank_of(entry.first);
+            error = std::max(error, std::fabs(off));
+        }
+        std::cout << round << "\t" << update_pushes << "\t"
+                  << update_took.count() << "\t" << full_passes << "\t"
+                  << full_took.count() << "\t" << error << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "tag_index.h"
+#include "workload.h"
+#include <chrono>
+#include <cstdlib>
+#include <malloc.h>
+#include <thread>
+
+/*
+ * insert scaling of the sharded tag_index against a single hash_table
+ * behind one mutex, for 1, 2, 4, ... threads. tag_index is run twice: with
+ * the inserts dealt out round robin, so threads meet on shard locks, and
+ * split by shard the way document_store publishes a batch, so every thread
+ * owns its shards.
+ * usage: tag_bench [inserts] [tags] [max threads] [zipf theta]
+ */
+
+/* runs body(thread) on threads threads and returns inserts per second */
+template <typename F>
+static uint64_t timed(uint32_t threads, uint64_t inserts, F body)
+{
+    std::vector<std::thread> pool;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] { body(t); });
+    }
+    for(std::thread& thread : pool) { thread.join(); }
+    std::chrono::duration<double> took =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<uint64_t>(inserts / took.count());
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t inserts =
+        argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    uint64_t tags = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t max_threads =
+        argc > 3 ? std::strtoul(argv[3], nullptr, 10) : cores;
+    double theta = argc > 4 ? std::strtod(argv[4], nullptr) : 0;
+
+    std::vector<uint32_t> symbols;
+    for(uint64_t i = 0; i < tags; i++) {
+        symbols.push_back(
+            tag_interner::global().intern("tag_" + std::to_string(i)));
+    }
+    // 64 slices so every thread count divides the same work evenly
+    workload_rng rng(7);
+    zipf_sampler pick(tags, theta);
+    std::vector<std::vector<uint32_t>> work(64);
+    for(uint64_t i = 0; i < inserts; i++) {
+        work[i % work.size()].push_back(symbols[pick.next(rng)]);
+    }
+    document doc(0, "");
+
+    std::cout << "# tag_bench inserts=" << inserts << " tags=" << tags
+              << " zipf=" << theta << " cores=" << cores << "\n"
+              << "threads\tlocked_hash_table\ttag_index\t"
+                 "tag_index_by_shard\tspeedup" << std::endl;
+    for(uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        // each thread takes every threads-th slice
+        auto dealt = [&](uint32_t t, auto insert) {
+            for(uint64_t i = t; i < work.size(); i += threads) {
+                for(uint32_t symbol : work[i]) { insert(symbol); }
+            }
+        };
+        uint64_t locked;
+        {
+            hash_table table;
+            std::mutex lock;
+            locked = timed(threads, inserts, [&](uint32_t t) {
+                dealt(t, [&](uint32_t symbol) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    table.insert(symbol, &doc);
+                });
+            });
+        }
+        // millions of freed hash_nodes otherwise make every later posting
+        // list reallocation crawl through glibc's bins
+        malloc_trim(0);
+        uint64_t sharded;
+        {
+            tag_index index;
+            sharded = timed(threads, inserts, [&](uint32_t t) {
+                dealt(t, [&](uint32_t symbol) { index.insert(symbol, &doc); });
+            });
+        }
+        malloc_trim(0);
+        uint64_t owned;
+        {
+            // every thread reads all of the work, inserts only its shards
+            tag_index index;
+            uint32_t shards = index.shard_count();
+            owned = timed(threads, inserts, [&](uint32_t t) {
+                uint32_t first = t * shards / threads;
+                uint32_t last = (t + 1) * shards / threads;
+                for(const std::vector<uint32_t>& slice : work) {
+                    for(uint32_t symbol : slice) {
+                        uint32_t shard = index.shard_index(symbol);
+                        if(shard >= first && shard < last) {
+                            index.insert(symbol, &doc);
+                        }
+                    }
+                }
+            });
+        }
+        malloc_trim(0);
+        std::cout << threads << "\t" << locked << "\t" << sharded << "\t"
+                  << owned << "\t"
+                  << static_cast<double>(owned) / locked
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "wal.h"
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * ops/sec of the write-ahead log under every durability level. a
+ * transaction is one insert, one tag and one reference. under group every
+ * worker commits after each transaction, so the row measures how many
+ * waiting workers one fsync covers.
+ * usage: wal_bench [ops per level] [threads]
+ */
+int main(int argc, char** argv)
+{
+    uint64_t ops = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    uint64_t threads =
+        argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                 : std::max(1u, std::thread::hardware_concurrency());
+
+    const char* names[] = {"none", "group", "always"};
+    wal_sync levels[] = {wal_sync::none, wal_sync::group, wal_sync::always};
+    const std::string path = "wal_bench.log";
+
+    std::cout << "level\tthreads\tops\tops_per_sec" << std::endl;
+    for(int level = 0; level < 3; level++) {
+        std::remove(path.c_str());
+        // waiting on fsync is orders of magnitude slower, keep the run short
+        uint64_t level_ops = levels[level] == wal_sync::always
+                                 ? std::min<uint64_t>(ops, 2000)
+                             : levels[level] == wal_sync::group
+                                 ? std::min<uint64_t>(ops, 20000)
+                                 : ops;
+        auto start = std::chrono::steady_clock::now();
+        {
+            wal_writer wal(path, levels[level]);
+            std::vector<std::thread> workers;
+            for(uint64_t t = 0; t < threads; t++) {
+                workers.emplace_back([&, t] {
+                    document doc(0, "Content for document");
+                    doc.add_tag("all_docs");
+                    uint64_t logged = 0;
+                    for(uint64_t i = t; i < level_ops; i += threads) {
+                        doc.id = i;
+                        // one insert, one tag and one reference per three ops
+                        switch(i % 3) {
+                        case 0:
+                            wal.log_insert(&doc);
+                            break;
+                        case 1:
+                            wal.log_tag("all_docs", i);
+                            break;
+                        default:
+                            wal.log_reference(i, i / 2);
+                            break;
+                        }
+                        // by the worker's own count, i % 3 is uneven across
+                        // workers when the thread count is a multiple of 3
+                        if(levels[level] == wal_sync::group
+                           && ++logged % 3 == 0) {
+                            wal.commit();
+                        }
+                    }
+                });
+            }
+            for(std::thread& worker : workers) { worker.join(); }
+            wal.commit();
+        }
+        std::chrono::duration<double> took =
+            std::chrono::steady_clock::now() - start;
+        std::cout << names[level] << "\t" << threads << "\t" << level_ops
+                  << "\t" << static_cast<uint64_t>(level_ops / took.count())
+                  << std::endl;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
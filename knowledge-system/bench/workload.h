@@ -0,0 +1,160 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * deterministic workload pieces for the benchmarks: a fast rng, zipfian
+ * samplers for ids and tags, reference graph shapes and read/write mixes.
+ * everything is seeded, so two runs with the same flags do the same work
+ * and their reports can be diffed between commits.
+ */
+
+class workload_rng {
+    // splitmix64, small state and good enough spread for benchmarking
+public:
+    workload_rng(uint64_t seed): state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (this->state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    /* uniform in [0, n) */
+    uint64_t below(uint64_t n) { return this->next() % n; }
+    /* uniform in [0, 1) */
+    double unit() { return (this->next() >> 11) * (1.0 / 9007199254740992.0); }
+private:
+    uint64_t state;
+};
+
+class zipf_sampler {
+    // gray et al.'s "quickly generating billion-record synthetic databases"
+    // sampler, the one ycsb uses. rank 0 is the most popular item. setup
+    // sums n terms once, every draw after that is constant time.
+public:
+    zipf_sampler(uint64_t n, double theta): n(n), theta(theta)
+    {
+        if(theta <= 0) { return; } // uniform, see next()
+        this->zeta_n = zeta(n, theta);
+        double zeta_2 = zeta(2, theta);
+        this->alpha = 1.0 / (1.0 - theta);
+        this->eta = (1 - std::pow(2.0 / n, 1 - theta))
+                    / (1 - zeta_2 / this->zeta_n);
+    }
+
+    uint64_t next(workload_rng& rng)
+    {
+        if(this->theta <= 0) { return rng.below(this->n); }
+        double u = rng.unit();
+        double uz = u * this->zeta_n;
+        if(uz < 1.0) { return 0; }
+        if(uz < 1.0 + std::pow(0.5, this->theta)) { return 1; }
+        uint64_t rank = static_cast<uint64_t>(
+            this->n * std::pow(this->eta * u - this->eta + 1, this->alpha));
+        return std::min(rank, this->n - 1);
+    }
+private:
+    uint64_t n;
+    double theta;
+    double zeta_n = 0;
+    double alpha = 0;
+    double eta = 0;
+
+    static double zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for(uint64_t i = 1; i <= n; i++) { sum += 1.0 / std::pow(i, theta); }
+        return sum;
+    }
+};
+
+enum class graph_shape {
+    power_law, // preferential attachment, a few hubs collect most backlinks
+    chain, // 0 -> 1 -> 2 -> ..., the deepest possible reachability search
+    scc // dense strongly connected clusters joined into a chain
+};
+
+inline bool parse_graph_shape(const std::string& name, graph_shape& shape)
+{
+    if(name == "power_law") { shape = graph_shape::power_law; }
+    else if(name == "chain") {
+        shape = graph_shape::chain;
+    }
+    else if(name == "scc") {
+        shape = graph_shape::scc;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/* about edges_per_node * nodes (from, to) pairs over ids [0, nodes) */
+inline std::vector<std::pair<uint64_t, uint64_t>>
+make_graph(graph_shape shape, uint64_t nodes, uint64_t edges_per_node,
+           workload_rng& rng)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> edges;
+    if(nodes < 2) { return edges; }
+
+    if(shape == graph_shape::chain) {
+        for(uint64_t i = 0; i + 1 < nodes; i++) {
+            edges.push_back(std::make_pair(i, i + 1));
+        }
+    }
+    else if(shape == graph_shape::power_law) {
+        // every new node links to endpoints of earlier edges, so nodes that
+        // are already well linked keep attracting more links
+        std::vector<uint64_t> endpoints;
+        edges.push_back(std::make_pair(1, 0));
+        endpoints.push_back(0);
+        endpoints.push_back(1);
+        for(uint64_t i = 2; i < nodes; i++) {
+            for(uint64_t e = 0; e < edges_per_node; e++) {
+                uint64_t to = endpoints[rng.below(endpoints.size())];
+                edges.push_back(std::make_pair(i, to));
+                endpoints.push_back(to);
+            }
+            endpoints.push_back(i);
+        }
+    }
+    else { // scc
+        const uint64_t cluster = 64;
+        for(uint64_t first = 0; first < nodes; first += cluster) {
+            uint64_t size = std::min(cluster, nodes - first);
+            // a ring makes the cluster strongly connected, random chords
+            // make it dense
+            for(uint64_t i = 0; i < size; i++) {
+                edges.push_back(
+                    std::make_pair(first + i, first + (i + 1) % size));
+                for(uint64_t e = 1; e < edges_per_node; e++) {
+                    edges.push_back(
+                        std::make_pair(first + i, first + rng.below(size)));
+                }
+            }
+            if(first + size < nodes) {
+                edges.push_back(std::make_pair(first, first + size));
+            }
+        }
+    }
+    return edges;
+}
+
+class op_mix {
+    // decides, op by op, between a read and a write with a fixed read share
+public:
+    op_mix(double read_ratio): read_ratio(read_ratio) {}
+    bool is_read(workload_rng& rng) { return rng.unit() < this->read_ratio; }
+private:
+    double read_ratio;
+};
+
+#endif // WORKLOAD_H
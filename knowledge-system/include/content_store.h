@@ -0,0 +1,379 @@
+#ifndef CONTENT_STORE_H
+#define CONTENT_STORE_H
+
+#include "sys.h"
+#include <cstring>
+#include <functional>
+#include <list>
+
+/*
+ * deduplicated, block-compressed home for document bodies.
+ *
+ * identical bodies are stored once: a body is hashed, and a candidate with
+ * the same hash, length and check hash is only reused once its bytes compare
+ * equal. unique bodies are appended to an open block, and once that
+ * block reaches block_bytes it is sealed and compressed with a small lz77
+ * codec using the lz4 sequence layout. a handful of decompressed blocks are
+ * kept in an lru so repeated reads of neighbouring documents stay cheap.
+ *
+ * every put() takes a reference on its body and release() drops one. a body
+ * nobody references is no longer matched by put(), and a block is freed as
+ * soon as none of its bodies are referenced.
+ */
+class content_store {
+public:
+    content_store(uint32_t block_bytes = 16 * 1024, uint32_t cache_blocks = 16)
+        : block_bytes(block_bytes), cache_blocks(cache_blocks),
+          logical_bytes(0), unique_bytes(0), compressed_bytes(0), open_live(0)
+    {
+        // block() hands out a reference into the cache
+        if(cache_blocks == 0) {
+            throw std::logic_error("ERR: CONTENT STORE NEEDS A CACHED BLOCK.");
+        }
+    } // content store constructor
+
+    /* stores body and returns its handle, equal bodies share one handle */
+    uint32_t put(const std::string& body)
+    {
+        KS_TIME(KS_CONTENT_PUT);
+        this->logical_bytes += body.size();
+
+        // the length and a second hash weed out collisions cheaply, only a
+        // likely duplicate pays for the byte comparison (and maybe a block
+        // decompression, which the lru then keeps for its neighbours)
+        uint64_t hash = std::hash<std::string>()(body);
+        uint64_t check = fnv1a(body);
+        auto range = this->by_hash.equal_range(hash);
+        for(auto curr = range.first; curr != range.second; curr++) {
+            entry& candidate = this->entries[curr->second];
+            if(candidate.length == body.size() && candidate.check == check
+               && this->holds(candidate, body)) {
+                candidate.refs++;
+                return curr->second;
+            }
+        }
+
+        entry location;
+        location.block = static_cast<uint32_t>(this->sealed.size());
+        location.offset = static_cast<uint32_t>(this->open_block.size());
+        location.length = static_cast<uint32_t>(body.size());
+        location.hash = hash;
+        location.check = check;
+        location.refs = 1;
+        this->open_block.append(body);
+        this->open_live++;
+        this->unique_bytes += body.size();
+
+        uint32_t handle = static_cast<uint32_t>(this->entries.size());
+        this->entries.push_back(location);
+        this->by_hash.emplace(hash, handle);
+
+        if(this->open_block.size() >= this->block_bytes) { this->seal(); }
+        return handle;
+    }
+
+    std::string get(uint32_t handle)
+    {
+        KS_TIME(KS_CONTENT_GET);
+        const entry& location = this->entries[handle];
+        if(location.refs == 0) {
+            throw std::logic_error("ERR: CONTENT WAS RELEASED.");
+        }
+        if(location.block == this->sealed.size()) { // still open
+            return this->open_block.substr(location.offset, location.length);
+        }
+        return this->block(location.block)
+            .substr(location.offset, location.length);
+    }
+
+    /* moves doc->content into the store and frees the string */
+    void compact(document* doc)
+    {
+        if(doc->content_handle != document::inline_content) { return; }
+        doc->content_handle = this->put(doc->content);
+        std::string().swap(doc->content);
+    }
+    /* drops one reference to the body behind handle */
+    void release(uint32_t handle)
+    {
+        entry& location = this->entries[handle];
+        if(location.refs == 0) {
+            throw std::logic_error("ERR: CONTENT WAS RELEASED.");
+        }
+        if(--location.refs > 0) { return; }
+
+        auto range = this->by_hash.equal_range(location.hash);
+        for(auto curr = range.first; curr != range.second; curr++) {
+            if(curr->second == handle) {
+                this->by_hash.erase(curr);
+                break;
+            }
+        }
+        if(location.block == this->sealed.size()) {
+            // nothing reads a dead offset again, so an empty block restarts
+            if(--this->open_live == 0) { this->open_block.clear(); }
+            return;
+        }
+        sealed_block& block = this->sealed[location.block];
+        if(--block.live > 0) { return; }
+        this->compressed_bytes -= block.bytes.size();
+        std::vector<uint8_t>().swap(block.bytes);
+        auto cached = this->cache.find(location.block);
+        if(cached != this->cache.end()) {
+            this->lru.erase(cached->second.second);
+            this->cache.erase(cached);
+        }
+    }
+    /* releases doc's body, doc->content stays empty */
+    void release(document* doc)
+    {
+        if(doc->content_handle == document::inline_content) { return; }
+        this->release(doc->content_handle);
+        doc->content_handle = document::inline_content;
+    }
+
+    std::string content_of(document* doc)
+    {
+        if(doc->content_handle == document::inline_content) {
+            return doc->content;
+        }
+        return this->get(doc->content_handle);
+    }
+    void display(document* doc) { doc->display(this->content_of(doc)); }
+
+    uint64_t get_logical_bytes() { return this->logical_bytes; }
+    uint64_t get_unique_bytes() { return this->unique_bytes; }
+    /* bytes actually held: compressed blocks plus the open block */
+    uint64_t get_stored_bytes()
+    {
+        return this->compressed_bytes + this->open_block.size();
+    }
+
+    /*
+     * lz77 with the lz4 sequence layout:
+     * | token | extra literal length | literals | offset | extra match length |
+     * the token's high nibble is the literal length, the low nibble the
+     * match length minus 4, and 15 in either means "more bytes follow".
+     * the final sequence carries literals only.
+     */
+    static std::vector<uint8_t> compress(const std::string& in)
+    {
+        std::vector<uint8_t> out;
+        std::vector<int64_t> table(1 << hash_bits, -1);
+        uint64_t n = in.size();
+        uint64_t anchor = 0;
+        uint64_t i = 0;
+        while(i + min_match <= n) {
+            uint32_t seq;
+            std::memcpy(&seq, in.data() + i, sizeof(seq));
+            uint32_t slot = (seq * 2654435761u) >> (32 - hash_bits);
+            int64_t candidate = table[slot];
+            table[slot] = i;
+
+            if(candidate < 0 || i - candidate > 0xFFFF
+               || std::memcmp(in.data() + candidate, in.data() + i, min_match)
+                      != 0) {
+                i++;
+                continue;
+            }
+            uint64_t length = min_match;
+            while(i + length < n && in[candidate + length] == in[i + length]) {
+                length++;
+            }
+            put_sequence(out, in.data() + anchor, i - anchor, i - candidate,
+                         length);
+            i += length;
+            anchor = i;
+        }
+        put_sequence(out, in.data() + anchor, n - anchor, 0, 0);
+        return out;
+    }
+
+    static std::string decompress(const std::vector<uint8_t>& in,
+                                  uint64_t raw_size)
+    {
+        std::string out(raw_size, '\0');
+        char* dst = &out[0];
+        char* dst_end = dst + raw_size;
+        const uint8_t* p = in.data();
+        const uint8_t* end = p + in.size();
+        while(p < end) {
+            uint8_t token = *p++;
+            uint64_t literals = get_length(p, end, token >> 4);
+            if(literals > static_cast<uint64_t>(end - p)
+               || literals > static_cast<uint64_t>(dst_end - dst)) {
+                corrupt();
+            }
+            std::memcpy(dst, p, literals);
+            dst += literals;
+            p += literals;
+            if(p == end) { break; } // the final sequence has no match
+
+            if(end - p < 2) { corrupt(); }
+            uint64_t offset = p[0] | (p[1] << 8);
+            p += 2;
+            uint64_t length = get_length(p, end, token & 0x0F) + min_match;
+            if(offset == 0 || offset > static_cast<uint64_t>(dst - &out[0])
+               || length > static_cast<uint64_t>(dst_end - dst)) {
+                corrupt();
+            }
+            const char* from = dst - offset;
+            if(offset >= length) { std::memcpy(dst, from, length); }
+            else { // the match overlaps what it is copying
+                for(uint64_t j = 0; j < length; j++) { dst[j] = from[j]; }
+            }
+            dst += length;
+        }
+        if(dst != dst_end) { corrupt(); }
+        return out;
+    }
+private:
+    static constexpr uint32_t hash_bits = 14;
+    static constexpr uint64_t min_match = 4;
+
+    struct entry {
+        uint32_t block; // sealed.size() while the block is still open
+        uint32_t offset; // within the decompressed block
+        uint32_t length;
+        uint32_t refs; // 0 once released
+        uint64_t hash; // key in by_hash
+        uint64_t check; // fnv-1a of the body
+    };
+
+    struct sealed_block {
+        std::vector<uint8_t> bytes;
+        uint32_t raw_size;
+        uint32_t live; // bodies still referenced, freed at 0
+    };
+
+    uint32_t block_bytes;
+    uint32_t cache_blocks;
+    uint64_t logical_bytes; // everything ever put, duplicates included
+    uint64_t unique_bytes; // put after deduplication
+    uint64_t compressed_bytes; // sealed blocks only
+
+    std::vector<entry> entries; // by handle
+    std::unordered_multimap<uint64_t, uint32_t> by_hash;
+    std::vector<sealed_block> sealed;
+    std::string open_block;
+    uint32_t open_live; // bodies in the open block still referenced
+
+    // most recently used block at the front
+    std::list<uint32_t> lru;
+    std::unordered_map<uint32_t,
+                       std::pair<std::string, std::list<uint32_t>::iterator>>
+        cache;
+
+    void seal()
+    {
+        sealed_block block;
+        block.bytes = compress(this->open_block);
+        block.raw_size = static_cast<uint32_t>(this->open_block.size());
+        block.live = this->open_live;
+        this->open_live = 0;
+        this->compressed_bytes += block.bytes.size();
+        this->sealed.push_back(block);
+        this->open_block.clear();
+    }
+
+    /* whether the bytes behind location are exactly body */
+    bool holds(const entry& location, const std::string& body)
+    {
+        const std::string& bytes = location.block == this->sealed.size()
+                                       ? this->open_block
+                                       : this->block(location.block);
+        return bytes.compare(location.offset, location.length, body) == 0;
+    }
+
+    const std::string& block(uint32_t index)
+    {
+        auto found = this->cache.find(index);
+        if(found != this->cache.end()) {
+            this->lru.splice(this->lru.begin(), this->lru,
+                             found->second.second);
+            return found->second.first;
+        }
+
+        KS_COUNT(KS_CONTENT_CACHE_MISSES, 1);
+        if(this->cache.size() >= this->cache_blocks) {
+            this->cache.erase(this->lru.back());
+            this->lru.pop_back();
+        }
+        this->lru.push_front(index);
+        const sealed_block& block = this->sealed[index];
+        auto inserted = this->cache.emplace(
+            index, std::make_pair(decompress(block.bytes, block.raw_size),
+                                  this->lru.begin()));
+        return inserted.first->second.first;
+    }
+
+    static uint64_t fnv1a(const std::string& body)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for(unsigned char c : body) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static void put_length(std::vector<uint8_t>& out, uint64_t extra)
+    {
+        while(extra >= 255) {
+            out.push_back(255);
+            extra -= 255;
+        }
+        out.push_back(static_cast<uint8_t>(extra));
+    }
+    static uint64_t get_length(const uint8_t*& p, const uint8_t* end,
+                               uint64_t nibble)
+    {
+        uint64_t length = nibble;
+        if(nibble != 15) { return length; }
+        while(true) {
+            if(p == end) { corrupt(); }
+            uint8_t extra = *p++;
+            length += extra;
+            if(extra != 255) { return length; }
+        }
+    }
+
+    /* match_len == 0 marks the final, literal only sequence */
+    static void put_sequence(std::vector<uint8_t>& out, const char* literals,
+                             uint64_t literal_len, uint64_t offset,
+                             uint64_t match_len)
+    {
+        uint64_t match_code = match_len == 0 ? 0 : match_len - min_match;
+        uint64_t token = (std::min<uint64_t>(literal_len, 15) << 4)
+                         | std::min<uint64_t>(match_code, 15);
+        out.push_back(static_cast<uint8_t>(token));
+        if(literal_len >= 15) { put_length(out, literal_len - 15); }
+        out.insert(out.end(), literals, literals + literal_len);
+        if(match_len == 0) { return; }
+
+        out.push_back(static_cast<uint8_t>(offset & 0xFF));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        if(match_code >= 15) { put_length(out, match_code - 15); }
+    }
+
+    [[noreturn]] static void corrupt()
+    {
+        throw std::runtime_error("ERR: CORRUPT CONTENT BLOCK.");
+    }
+};
+
+/*
+ * doc's body wherever it lives. a compacted document needs the store it was
+ * compacted into, without one this throws rather than hand back the empty
+ * string compact() left behind.
+ */
+inline std::string document_body(document* doc, content_store* contents)
+{
+    if(doc->content_handle == document::inline_content) { return doc->content; }
+    if(contents == nullptr) {
+        throw std::logic_error("ERR: DOCUMENT CONTENT IS IN A CONTENT STORE.");
+    }
+    return contents->content_of(doc);
+}
+
+#endif // CONTENT_STORE_H
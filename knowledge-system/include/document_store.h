@@ -0,0 +1,317 @@
+#ifndef DOCUMENT_STORE_H
+#define DOCUMENT_STORE_H
+
+#include "content_store.h"
+#include "fulltext.h"
+#include "sys.h"
+#include "tag_index.h"
+#include "worker_pool.h"
+
+/*
+ * owns every document and keeps the id index, tag index, task queue,
+ * reference graph, full-text index and content store in step with each
+ * other, so removing a document can never leave a dangling pointer behind.
+ *
+ * ingestion works in batches. the parse stage (building documents, interning
+ * tags, tokenizing content, collecting edges) runs on all workers, then the
+ * batch is published under the write lock with every index updated by its
+ * own worker, and the tag index by several, each owning a range of its
+ * shards. readers hold the shared lock, so they either see a whole batch
+ * or none of it.
+ *
+ * the workers are a pool that lives as long as the store, so a single
+ * insert() does not start any threads.
+ */
+class document_store {
+public:
+    struct raw_document {
+        uint64_t id;
+        uint8_t priority;
+        std::string content;
+        std::vector<std::string> tags;
+        std::vector<uint64_t> refs;
+    };
+
+    document_store(uint32_t workers = std::thread::hardware_concurrency())
+        : workers(std::max(1u, workers)), pool(this->workers - 1)
+    {} // document store constructor
+
+    ~document_store()
+    {
+        std::vector<document*> docs;
+        this->tree.for_each([&](document* doc) { docs.push_back(doc); });
+        for(document* doc : docs) { delete doc; }
+    }
+
+    document_store(const document_store&) = delete;
+    document_store& operator=(const document_store&) = delete;
+
+    void insert(raw_document raw)
+    {
+        std::vector<raw_document> batch;
+        batch.push_back(std::move(raw));
+        this->ingest(std::move(batch));
+    }
+
+    /*
+     * all or nothing: if any id already exists, or repeats inside the batch,
+     * nothing is published and std::logic_error is thrown.
+     */
+    void ingest(std::vector<raw_document> batch)
+    {
+        KS_TIME(KS_STORE_INGEST);
+        parsed_batch parsed;
+        this->pool.wait(this->parse(batch, parsed));
+        this->publish(std::move(parsed));
+    }
+
+    /* parses batch i + 1 while batch i is being published */
+    void ingest(std::vector<std::vector<raw_document>> batches)
+    {
+        KS_TIME(KS_STORE_INGEST);
+        if(batches.empty()) { return; }
+        parsed_batch curr;
+        this->pool.wait(this->parse(batches[0], curr));
+        for(uint64_t i = 0; i < batches.size(); i++) {
+            parsed_batch next;
+            worker_pool::job parsing;
+            if(i + 1 < batches.size()) {
+                parsing = this->parse(batches[i + 1], next);
+            }
+            try {
+                this->publish(std::move(curr));
+            }
+            catch(...) {
+                if(parsing) {
+                    this->pool.wait(parsing);
+                    discard(next);
+                }
+                throw;
+            }
+            if(parsing) { this->pool.wait(parsing); }
+            curr = std::move(next);
+        }
+    }
+
+    /* removes the document from every index and frees it */
+    bool remove(uint64_t id)
+    {
+        KS_TIME(KS_STORE_REMOVE);
+        std::unique_lock<std::shared_mutex> guard(this->lock);
+        document* doc = this->tree.find(id);
+        if(doc == nullptr) { return false; }
+
+        this->tree.remove(id);
+        for(uint32_t symbol : doc->tags) { this->tags.remove(symbol, doc); }
+        this->pq.remove(doc);
+        this->graph.remove_document(id);
+        this->text.remove(doc);
+        {
+            std::lock_guard<std::mutex> content_guard(this->content_lock);
+            this->contents.release(doc);
+        }
+        this->count--;
+        delete doc;
+        return true;
+    }
+
+    /*
+     * documents stay valid until they are removed from the store. publish
+     * moves every body into the content store, so doc->content is empty:
+     * read the body with content_of(doc).
+     */
+    document* find(uint64_t id)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return this->tree.find(id);
+    }
+    std::vector<document*> search_tag(const std::string& tag)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return this->tags.search(tag);
+    }
+    std::vector<fulltext_index::hit> search_text(const std::string& query,
+                                                 uint32_t k)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return this->text.search(query, k);
+    }
+    bool is_reachable(uint64_t source_id, uint64_t target_id)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return this->graph.is_reachable(source_id, target_id);
+    }
+    std::vector<uint64_t> get_backlinks(uint64_t id)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return this->graph.get_backlinks(id);
+    }
+    std::string content_of(document* doc)
+    {
+        // the block cache changes on every read, so it has a lock of its own
+        std::lock_guard<std::mutex> guard(this->content_lock);
+        return this->contents.content_of(doc);
+    }
+
+    /* pops the next task, the document itself stays in the store */
+    document* get_next_task()
+    {
+        std::unique_lock<std::shared_mutex> guard(this->lock);
+        return this->pq.get_next_task();
+    }
+    void add_reference(uint64_t from_id, uint64_t to_id)
+    {
+        std::unique_lock<std::shared_mutex> guard(this->lock);
+        this->graph.add_reference(from_id, to_id);
+    }
+    uint64_t size()
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return this->count;
+    }
+
+    /* counters and latency histograms of every structure, as json */
+    std::string stats() { return ks_stats::global().json(); }
+private:
+    struct parsed_batch {
+        std::vector<document*> docs;
+        std::vector<fulltext_index::term_counts> terms; // by position in docs
+    };
+
+    uint32_t workers;
+    worker_pool pool; // workers - 1 threads, the caller is the last worker
+    std::shared_mutex lock; // guards every index below
+    std::mutex content_lock;
+    uint64_t count = 0;
+
+    avl_tree tree; // the owner, every live document is in here
+    tag_index tags;
+    priority_queue pq;
+    knowledge_graph graph;
+    fulltext_index text;
+    content_store contents;
+
+    /*
+     * parse stage, no locks taken apart from the tag interner's. fills
+     * parsed on the pool, wait on the returned job before reading it.
+     */
+    worker_pool::job parse(const std::vector<raw_document>& batch,
+                           parsed_batch& parsed)
+    {
+        parsed.docs.assign(batch.size(), nullptr);
+        parsed.terms.resize(batch.size());
+
+        uint64_t parts = std::min<uint64_t>(this->workers, batch.size());
+        uint64_t chunk = parts == 0 ? 0 : (batch.size() + parts - 1) / parts;
+        return this->pool.start(parts, [&batch, &parsed, chunk](uint64_t p) {
+            uint64_t end = std::min<uint64_t>((p + 1) * chunk, batch.size());
+            for(uint64_t i = p * chunk; i < end; i++) {
+                const raw_document& raw = batch[i];
+                document* doc = new document(raw.id, raw.content);
+                doc->priority = raw.priority;
+                for(const std::string& tag : raw.tags) { doc->add_tag(tag); }
+                for(uint64_t ref : raw.refs) { doc->add_ref(ref); }
+                parsed.terms[i] = fulltext_index::analyze(raw.content);
+                parsed.docs[i] = doc;
+            }
+        });
+    }
+
+    static void discard(const parsed_batch& parsed)
+    {
+        for(document* doc : parsed.docs) { delete doc; }
+    }
+
+    /*
+     * publish stage, every index is updated by its own worker. the tag index
+     * and the graph are split further: each of their parts walks the whole
+     * batch but only inserts into its own range of shards or buckets, so no
+     * two parts ever touch the same one and both scale with the workers.
+     */
+    void publish(parsed_batch parsed)
+    {
+        std::unique_lock<std::shared_mutex> guard(this->lock);
+
+        std::vector<uint64_t> ids;
+        for(document* doc : parsed.docs) { ids.push_back(doc->id); }
+        std::sort(ids.begin(), ids.end());
+        bool clash = std::adjacent_find(ids.begin(), ids.end()) != ids.end();
+        for(uint64_t i = 0; !clash && i < ids.size(); i++) {
+            clash = this->tree.find(ids[i]) != nullptr;
+        }
+        if(clash) {
+            discard(parsed);
+            throw std::logic_error("ERR: A DOCUMENT WITH THE SAME ID EXISTS.");
+        }
+
+        const std::vector<document*>& docs = parsed.docs;
+        uint32_t tag_parts = std::min(this->workers, this->tags.shard_count());
+        uint64_t graph_parts =
+            std::min<uint64_t>(this->workers, this->graph.bucket_count());
+        this->pool.run(3 + tag_parts + graph_parts, [&](uint64_t part) {
+            if(part == 0) {
+                for(document* doc : docs) { this->tree.insert(doc); }
+            }
+            else if(part == 1) {
+                for(document* doc : docs) { this->pq.add_new_task(doc); }
+            }
+            else if(part == 2) {
+                // the text index reads the parsed terms, so content can move
+                for(uint64_t i = 0; i < docs.size(); i++) {
+                    this->text.add(docs[i], parsed.terms[i]);
+                }
+                std::lock_guard<std::mutex> content_guard(this->content_lock);
+                for(document* doc : docs) { this->contents.compact(doc); }
+            }
+            else if(part < 3 + tag_parts) {
+                this->publish_tags(docs, part - 3, tag_parts);
+            }
+            else {
+                this->publish_refs(docs, part - 3 - tag_parts, graph_parts);
+            }
+        });
+        this->count += docs.size();
+    }
+
+    /* the tags of docs whose shard is in part's share of the shards */
+    void publish_tags(const std::vector<document*>& docs, uint64_t part,
+                      uint64_t parts)
+    {
+        uint64_t shards = this->tags.shard_count();
+        uint64_t first = part * shards / parts;
+        uint64_t last = (part + 1) * shards / parts;
+        for(document* doc : docs) {
+            for(uint32_t symbol : doc->tags) {
+                uint64_t shard = this->tags.shard_index(symbol);
+                if(shard >= first && shard < last) {
+                    this->tags.insert(symbol, doc);
+                }
+            }
+        }
+    }
+
+    /*
+     * the edges of docs that land in part's share of the graph buckets: the
+     * forward edge by its source's bucket, the reverse edge by its target's.
+     */
+    void publish_refs(const std::vector<document*>& docs, uint64_t part,
+                      uint64_t parts)
+    {
+        uint64_t buckets = this->graph.bucket_count();
+        uint64_t first = part * buckets / parts;
+        uint64_t last = (part + 1) * buckets / parts;
+        auto owned = [&](uint64_t id) {
+            uint64_t bucket = this->graph.bucket_of(id);
+            return bucket >= first && bucket < last;
+        };
+        for(document* doc : docs) {
+            bool source = owned(doc->id);
+            for(uint64_t ref : doc->refs) {
+                if(source) { this->graph.add_forward(doc->id, ref); }
+                if(owned(ref)) { this->graph.add_backward(doc->id, ref); }
+            }
+        }
+    }
+};
+
+#endif // DOCUMENT_STORE_H
@@ -0,0 +1,366 @@
+#ifndef FULLTEXT_H
+#define FULLTEXT_H
+
+#include "content_store.h"
+#include "sys.h"
+#include <cctype>
+
+/*
+ * inverted index over document::content, ranked with okapi bm25.
+ *
+ * documents get dense ordinals in insertion order, so every posting list is
+ * sorted by ordinal and can be delta + varint encoded. lists are cut into
+ * blocks of 128 postings and each block remembers its last ordinal, which
+ * lets a cursor skip whole blocks while seeking.
+ *
+ * search() runs block-max wand: each term, and each block of its list,
+ * carries an upper bound on the score it can contribute, and documents whose
+ * summed upper bounds cannot beat the current k-th best score are skipped
+ * without being decoded.
+ */
+class fulltext_index {
+public:
+    struct hit {
+        document* doc;
+        double score;
+    };
+    typedef std::vector<std::pair<std::string, uint32_t>> term_counts;
+
+    fulltext_index(): total_len(0), live_docs(0) {} // constructor
+
+    /* lowercase alphanumeric runs with their frequencies */
+    static term_counts analyze(const std::string& text)
+    {
+        std::unordered_map<std::string, uint32_t> counts;
+        std::string token;
+        for(uint64_t i = 0; i <= text.size(); i++) {
+            unsigned char c = i < text.size() ? text[i] : ' ';
+            if(std::isalnum(c)) { token.push_back(std::tolower(c)); }
+            else if(!token.empty()) {
+                counts[token]++;
+                token.clear();
+            }
+        }
+        return term_counts(counts.begin(), counts.end());
+    }
+
+    /* contents is where doc was compacted to, if it was */
+    void add(document* doc, content_store* contents = nullptr)
+    {
+        this->add(doc, analyze(document_body(doc, contents)));
+    }
+    void add(document* doc, const term_counts& terms)
+    {
+        KS_TIME(KS_TEXT_ADD);
+        if(this->ordinals.count(doc) != 0) {
+            throw std::logic_error("ERR: DOCUMENT IS ALREADY INDEXED.");
+        }
+        uint32_t ordinal = static_cast<uint32_t>(this->docs.size());
+        uint32_t length = 0;
+        for(const std::pair<std::string, uint32_t>& term : terms) {
+            length += term.second;
+        }
+
+        for(const std::pair<std::string, uint32_t>& term : terms) {
+            auto found = this->term_ids.find(term.first);
+            if(found == this->term_ids.end()) {
+                found = this->term_ids
+                            .emplace(term.first,
+                                     static_cast<uint32_t>(this->lists.size()))
+                            .first;
+                this->lists.push_back(posting_list());
+            }
+            this->lists[found->second].append(ordinal, term.second, length);
+        }
+
+        this->docs.push_back(doc);
+        this->lengths.push_back(length);
+        this->deleted.push_back(false);
+        this->ordinals.emplace(doc, ordinal);
+        this->total_len += length;
+        this->live_docs++;
+    }
+
+    /* removed documents stay in the postings but are never returned */
+    void remove(document* doc)
+    {
+        auto found = this->ordinals.find(doc);
+        if(found == this->ordinals.end()) { return; }
+        this->deleted[found->second] = true;
+        this->total_len -= this->lengths[found->second];
+        this->live_docs--;
+        this->ordinals.erase(found);
+    }
+
+    /* the k best matching documents, best first */
+    std::vector<hit> search(const std::string& query, uint32_t k)
+    {
+        KS_TIME(KS_TEXT_SEARCH);
+        std::vector<hit> ret_vec;
+        if(k == 0 || this->live_docs == 0) { return ret_vec; }
+        double avg_len =
+            static_cast<double>(this->total_len) / this->live_docs;
+        if(avg_len == 0) { return ret_vec; }
+
+        std::vector<cursor> cursors;
+        for(const std::pair<std::string, uint32_t>& term : analyze(query)) {
+            auto found = this->term_ids.find(term.first);
+            if(found == this->term_ids.end()) { continue; }
+            const posting_list& list = this->lists[found->second];
+            cursors.push_back(cursor(&list, this->idf(list), avg_len));
+        }
+
+        // min-heap on score, the root is the k-th best hit so far
+        auto worse = [](const hit& a, const hit& b) {
+            return a.score > b.score;
+        };
+        std::vector<hit> top;
+
+        std::vector<cursor*> live;
+        for(cursor& curr : cursors) { live.push_back(&curr); }
+        while(true) {
+            live.erase(std::remove_if(live.begin(), live.end(),
+                                      [](cursor* c) { return c->done; }),
+                       live.end());
+            if(live.empty()) { break; }
+            std::sort(live.begin(), live.end(),
+                      [](cursor* a, cursor* b) { return a->doc < b->doc; });
+
+            double threshold = top.size() == k ? top.front().score : 0;
+
+            // pivot: first cursor where the summed upper bounds beat the
+            // threshold, no document before its ordinal can make the top k
+            double bound = 0;
+            uint64_t pivot = 0;
+            while(pivot < live.size()) {
+                bound += live[pivot]->upper;
+                if(bound > threshold) { break; }
+                pivot++;
+            }
+            if(pivot == live.size()) { break; }
+            uint32_t pivot_doc = live[pivot]->doc;
+
+            // block-max check: the blocks that would hold pivot_doc have
+            // tighter bounds than the whole lists, if even those cannot beat
+            // the threshold, skip past the nearest block end at once
+            uint64_t group = pivot;
+            while(group < live.size() && live[group]->doc == pivot_doc) {
+                group++;
+            }
+            uint32_t skip_to = group < live.size() ? live[group]->doc
+                                                   : UINT32_MAX;
+            double block_bound = 0;
+            for(uint64_t i = 0; i < group; i++) {
+                uint32_t block = live[i]->shallow(pivot_doc);
+                if(block == live[i]->list->blocks.size()) { continue; }
+                block_bound += live[i]->block_upper(block);
+                skip_to = std::min(
+                    skip_to, live[i]->list->blocks[block].last_doc + 1);
+            }
+            if(block_bound <= threshold) {
+                for(uint64_t i = 0; i < group; i++) {
+                    if(skip_to == UINT32_MAX) { live[i]->done = true; }
+                    else {
+                        live[i]->seek(skip_to);
+                    }
+                }
+                continue;
+            }
+
+            if(live[0]->doc == pivot_doc) {
+                double score = 0;
+                for(cursor* curr : live) {
+                    if(curr->doc != pivot_doc) { break; }
+                    score += curr->score(this->lengths[pivot_doc]);
+                    curr->next();
+                }
+                KS_COUNT(KS_TEXT_DOCS_SCORED, 1);
+                if(this->deleted[pivot_doc] || score <= threshold) {
+                    continue;
+                }
+
+                hit found_hit = {this->docs[pivot_doc], score};
+                if(top.size() == k) {
+                    std::pop_heap(top.begin(), top.end(), worse);
+                    top.pop_back();
+                }
+                top.push_back(found_hit);
+                std::push_heap(top.begin(), top.end(), worse);
+            }
+            else {
+                for(uint64_t i = 0; i < pivot; i++) {
+                    live[i]->seek(pivot_doc);
+                }
+            }
+        }
+
+        std::sort_heap(top.begin(), top.end(), worse);
+        return top;
+    }
+private:
+    static constexpr double k1 = 1.2;
+    static constexpr double b = 0.75;
+    static constexpr uint32_t block_size = 128;
+
+    struct block_meta {
+        uint32_t last_doc; // ordinal of the block's last posting
+        uint32_t offset; // where the block starts in bytes
+        uint32_t count; // postings in the block
+        uint32_t max_tf; // both feed the block's score upper bound
+        uint32_t min_len;
+    };
+
+    struct posting_list {
+        std::vector<uint8_t> bytes; // varint (gap, tf) pairs
+        std::vector<block_meta> blocks;
+        uint32_t doc_count = 0;
+        uint32_t max_tf = 0; // both feed the term's score upper bound
+        uint32_t min_len = UINT32_MAX;
+
+        void append(uint32_t ordinal, uint32_t tf, uint32_t length)
+        {
+            int64_t prev =
+                this->blocks.empty() ? -1 : this->blocks.back().last_doc;
+            if(this->blocks.empty()
+               || this->blocks.back().count == block_size) {
+                uint32_t offset = static_cast<uint32_t>(this->bytes.size());
+                block_meta meta = {ordinal, offset, 0, 0, UINT32_MAX};
+                this->blocks.push_back(meta);
+            }
+            put_varint(this->bytes, static_cast<uint32_t>(ordinal - prev - 1));
+            put_varint(this->bytes, tf);
+            block_meta& last = this->blocks.back();
+            last.last_doc = ordinal;
+            last.count++;
+            last.max_tf = std::max(last.max_tf, tf);
+            last.min_len = std::min(last.min_len, length);
+
+            this->doc_count++;
+            this->max_tf = std::max(this->max_tf, tf);
+            this->min_len = std::min(this->min_len, length);
+        }
+    };
+
+    struct cursor {
+        const posting_list* list;
+        double idf;
+        double avg_len;
+        double upper; // nothing in this list can score higher
+        uint32_t block;
+        uint32_t left; // postings left to decode in the current block
+        const uint8_t* at;
+        uint32_t doc;
+        uint32_t tf;
+        bool done;
+
+        cursor(const posting_list* list, double idf, double avg_len)
+            : list(list), idf(idf), avg_len(avg_len), done(false)
+        {
+            // bm25 grows with tf and shrinks with length
+            this->upper = this->weight(list->max_tf, list->min_len);
+            this->enter(0);
+        }
+
+        double weight(uint32_t tf, uint32_t length)
+        {
+            double norm = k1 * (1 - b + b * length / this->avg_len);
+            return this->idf * tf * (k1 + 1) / (tf + norm);
+        }
+        double score(uint32_t length) { return this->weight(this->tf, length); }
+        double block_upper(uint32_t block)
+        {
+            const block_meta& meta = this->list->blocks[block];
+            return this->weight(meta.max_tf, meta.min_len);
+        }
+
+        /* the block that would hold target, found without decoding */
+        uint32_t shallow(uint32_t target)
+        {
+            uint32_t ret = this->block;
+            while(ret < this->list->blocks.size()
+                  && this->list->blocks[ret].last_doc < target) {
+                ret++;
+            }
+            return ret;
+        }
+
+        void enter(uint32_t new_block)
+        {
+            this->block = new_block;
+            if(new_block >= this->list->blocks.size()) {
+                this->done = true;
+                return;
+            }
+            const block_meta& meta = this->list->blocks[new_block];
+            this->at = this->list->bytes.data() + meta.offset;
+            this->left = meta.count;
+            int64_t prev = new_block == 0
+                               ? -1
+                               : this->list->blocks[new_block - 1].last_doc;
+            this->decode(prev);
+        }
+
+        void decode(int64_t prev)
+        {
+            this->doc = static_cast<uint32_t>(prev + 1 + get_varint(this->at));
+            this->tf = get_varint(this->at);
+            this->left--;
+        }
+
+        void next()
+        {
+            if(this->left == 0) { this->enter(this->block + 1); }
+            else {
+                this->decode(this->doc);
+            }
+        }
+
+        /* moves to the first posting with an ordinal >= target */
+        void seek(uint32_t target)
+        {
+            if(this->done || this->doc >= target) { return; }
+            uint32_t next_block = this->shallow(target);
+            if(next_block != this->block) { this->enter(next_block); }
+            while(!this->done && this->doc < target) { this->next(); }
+        }
+    };
+
+    std::unordered_map<std::string, uint32_t> term_ids;
+    std::vector<posting_list> lists;
+    std::vector<document*> docs; // by ordinal
+    std::vector<uint32_t> lengths; // by ordinal, in tokens
+    std::vector<bool> deleted; // by ordinal
+    std::unordered_map<document*, uint32_t> ordinals;
+    uint64_t total_len; // tokens over live documents
+    uint32_t live_docs;
+
+    double idf(const posting_list& list)
+    {
+        // removed documents still count, their postings are still there
+        double total = this->docs.size();
+        double df = list.doc_count;
+        return std::log(1 + (total - df + 0.5) / (df + 0.5));
+    }
+
+    static void put_varint(std::vector<uint8_t>& out, uint32_t value)
+    {
+        while(value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+    static uint32_t get_varint(const uint8_t*& in)
+    {
+        uint32_t value = 0;
+        int shift = 0;
+        while(*in & 0x80) {
+            value |= static_cast<uint32_t>(*in++ & 0x7F) << shift;
+            shift += 7;
+        }
+        value |= static_cast<uint32_t>(*in++) << shift;
+        return value;
+    }
+};
+
+#endif // FULLTEXT_H
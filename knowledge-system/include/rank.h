@@ -0,0 +1,365 @@
+#ifndef RANK_H
+#define RANK_H
+
+#include "sys.h"
+#include "worker_pool.h"
+#include <cmath>
+#include <thread>
+
+/*
+ * pagerank over the reference graph, a measure of how central a document is.
+ * a document that references nothing spreads its rank evenly over every
+ * document.
+ *
+ * with that rule for dangling documents the ranks are r = h / sum(h), where
+ * h solves h = 1 + damping * A h and A holds 1 / out_degree(u) for every
+ * edge u -> v. h has no term that depends on the document count or on the
+ * dangling documents, so a change to the graph only disturbs h around the
+ * edges that changed. both compute() and update() work on h, and rank_of()
+ * divides by the running total.
+ *
+ * compute() copies the graph once into compressed sparse rows of incoming
+ * edges: every id gets a dense index, the sources of the edges into node v
+ * sit in in_sources[in_offsets[v] .. in_offsets[v + 1]). an iteration is
+ * then a pull: every node sums the contributions of its sources, reading two
+ * flat arrays front to back, and each worker owns a range of targets so no
+ * two threads write one slot. ranges are cut by edge count rather than node
+ * count, so a hub with a million backlinks does not leave one worker doing
+ * all the work. the workers are a pool owned by the ranker, so compute()
+ * starts no threads, and they meet at a barrier between the phases of a
+ * pass. iteration stops once the l1 change
+ * of the rank vector drops below tolerance, or after max_iterations.
+ *
+ * update() is incremental. the new edges change the equation of their
+ * sources' targets only, so it seeds residuals (how far h is from solving
+ * its equation) at those targets and at new documents, then pushes them:
+ * a node with a large residual takes it into h and passes damping times it
+ * on to its out-neighbours. the work stays in the part of the graph the new
+ * edges can reach, and stops once every residual is below what tolerance
+ * allows.
+ */
+class page_rank {
+public:
+    page_rank(uint32_t workers = std::thread::hardware_concurrency(),
+              double damping = 0.85, double tolerance = 1e-9,
+              uint32_t max_iterations = 100)
+        : workers(std::max(1u, workers)), pool(this->workers - 1),
+          damping(damping),
+          tolerance(tolerance), max_iterations(max_iterations),
+          last_iterations(0), last_delta(0), last_pushes(0), edges(0),
+          total(0)
+    {} // page rank constructor
+
+    /* ranks every document of graph from scratch, returns the passes taken */
+    uint32_t compute(knowledge_graph& graph)
+    {
+        KS_TIME(KS_RANK_COMPUTE);
+        this->ids.clear();
+        this->index.clear();
+        this->added_out.clear();
+        std::vector<std::pair<uint32_t, uint32_t>> pairs;
+        graph.for_each_reference([&](uint64_t from_id, uint64_t to_id) {
+            pairs.push_back(std::make_pair(this->index_of(from_id),
+                                           this->index_of(to_id)));
+        });
+        this->edges = pairs.size();
+
+        uint64_t n = this->ids.size();
+        std::vector<uint64_t> in_offsets;
+        std::vector<uint32_t> in_sources;
+        rows(pairs, n, true, in_offsets, in_sources);
+        rows(pairs, n, false, this->out_offsets, this->out_targets);
+        this->out_degree.assign(n, 0);
+        for(const std::pair<uint32_t, uint32_t>& edge : pairs) {
+            this->out_degree[edge.first]++;
+        }
+        this->residual.assign(n, 0);
+        this->scores.assign(n, 1);
+        return this->iterate(in_offsets, in_sources);
+    }
+
+    /*
+     * adds references (from_id, to_id) that were also added to the graph
+     * since the last compute() or update(), and re-ranks by pushing
+     * residuals out from them. returns the pushes it took. removals need a
+     * full compute().
+     */
+    uint64_t update(const std::vector<std::pair<uint64_t, uint64_t>>& added)
+    {
+        KS_TIME(KS_RANK_UPDATE);
+        std::vector<uint32_t> queue;
+        std::vector<bool> queued(this->ids.size(), false);
+        auto touch = [&](uint32_t v) {
+            if(v >= queued.size()) { queued.resize(v + 1, false); }
+            if(!queued[v]) {
+                queued[v] = true;
+                queue.push_back(v);
+            }
+        };
+
+        // new documents start with h = 0, one whole unit short
+        std::unordered_map<uint32_t, std::vector<uint32_t>> fresh_targets;
+        for(const std::pair<uint64_t, uint64_t>& edge : added) {
+            uint32_t from = this->index_of(edge.first);
+            uint32_t to = this->index_of(edge.second);
+            fresh_targets[from].push_back(to);
+        }
+        uint64_t n = this->ids.size();
+        if(this->out_offsets.empty()) { this->out_offsets.assign(1, 0); }
+        for(uint64_t v = this->scores.size(); v < n; v++) {
+            touch(static_cast<uint32_t>(v));
+        }
+        this->scores.resize(n, 0);
+        this->residual.resize(n, 1);
+        this->out_degree.resize(n, 0);
+        this->out_offsets.resize(n + 1, this->out_offsets.back());
+        this->edges += added.size();
+
+        // a source's old targets lose part of its share, the new ones gain
+        for(const auto& source : fresh_targets) {
+            uint32_t u = source.first;
+            uint32_t old_degree = this->out_degree[u];
+            uint32_t new_degree =
+                old_degree + static_cast<uint32_t>(source.second.size());
+            double share = this->damping * this->scores[u];
+            if(old_degree > 0 && share != 0) {
+                double lost = share / new_degree - share / old_degree;
+                this->for_each_target(u, [&](uint32_t w) {
+                    this->residual[w] += lost;
+                    touch(w);
+                });
+            }
+            std::vector<uint32_t>& targets = this->added_out[u];
+            for(uint32_t w : source.second) {
+                this->residual[w] += share / new_degree;
+                touch(w);
+                targets.push_back(w);
+            }
+            this->out_degree[u] = new_degree;
+        }
+
+        // a residual this small over every document keeps the ranks within
+        // tolerance of the exact answer
+        double threshold = this->tolerance * (1 - this->damping)
+                           * std::max(this->total, 1.0)
+                           / std::max<uint64_t>(n, 1);
+        this->last_pushes = 0;
+        for(uint64_t head = 0; head < queue.size(); head++) {
+            uint32_t v = queue[head];
+            queued[v] = false;
+            double amount = this->residual[v];
+            if(std::fabs(amount) <= threshold) { continue; }
+            this->residual[v] = 0;
+            this->scores[v] += amount;
+            this->total += amount;
+            this->last_pushes++;
+            if(this->out_degree[v] == 0) { continue; }
+            double share = this->damping * amount / this->out_degree[v];
+            this->for_each_target(v, [&](uint32_t w) {
+                this->residual[w] += share;
+                if(!queued[w] && std::fabs(this->residual[w]) > threshold) {
+                    queued[w] = true;
+                    queue.push_back(w);
+                }
+            });
+        }
+        KS_COUNT(KS_RANK_PUSHES, this->last_pushes);
+        return this->last_pushes;
+    }
+
+    /* 0 for documents the graph has never seen */
+    double rank_of(uint64_t id)
+    {
+        auto found = this->index.find(id);
+        if(found == this->index.end()) { return 0; }
+        return this->scores[found->second] / this->total;
+    }
+
+    /* the k most central documents, highest rank first */
+    std::vector<std::pair<uint64_t, double>> top(uint64_t k)
+    {
+        std::vector<uint32_t> order(this->ids.size());
+        for(uint32_t i = 0; i < order.size(); i++) { order[i] = i; }
+        k = std::min<uint64_t>(k, order.size());
+        std::partial_sort(order.begin(), order.begin() + k, order.end(),
+                          [&](uint32_t lhs, uint32_t rhs) {
+                              if(this->scores[lhs] != this->scores[rhs]) {
+                                  return this->scores[lhs] > this->scores[rhs];
+                              }
+                              return this->ids[lhs] < this->ids[rhs];
+                          });
+        std::vector<std::pair<uint64_t, double>> ret_vec;
+        for(uint64_t i = 0; i < k; i++) {
+            ret_vec.push_back(std::make_pair(
+                this->ids[order[i]], this->scores[order[i]] / this->total));
+        }
+        return ret_vec;
+    }
+
+    uint64_t size() { return this->ids.size(); }
+    uint64_t edge_count() { return this->edges; }
+    /* passes and final l1 change of the last compute() */
+    uint32_t get_iterations() { return this->last_iterations; }
+    double get_delta() { return this->last_delta; }
+    /* residual pushes of the last update() */
+    uint64_t get_pushes() { return this->last_pushes; }
+private:
+    uint32_t workers;
+    /*
+     * workers - 1 threads, the caller is the last worker. every part waits
+     * at the barrier for all the others, so each needs a thread of its own:
+     * parts never exceed workers and nothing else runs on this pool, so its
+     * idle threads take one part each while the caller takes the rest.
+     */
+    worker_pool pool;
+    double damping;
+    double tolerance;
+    uint32_t max_iterations;
+    uint32_t last_iterations;
+    double last_delta;
+    uint64_t last_pushes;
+    uint64_t edges;
+
+    std::vector<uint64_t> ids; // by dense index
+    std::unordered_map<uint64_t, uint32_t> index; // id -> dense index
+    // edges as of the last compute(), and those update() added since
+    std::vector<uint64_t> out_offsets; // n + 1 row starts into out_targets
+    std::vector<uint32_t> out_targets;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> added_out;
+    std::vector<uint32_t> out_degree;
+    std::vector<double> scores; // h by dense index, ranks are h / total
+    std::vector<double> residual; // by dense index, what h still owes
+    double total; // sum of scores
+
+    uint32_t index_of(uint64_t id)
+    {
+        auto inserted = this->index.emplace(id, this->ids.size());
+        if(inserted.second) { this->ids.push_back(id); }
+        return inserted.first->second;
+    }
+
+    template <typename F> void for_each_target(uint32_t u, F visit)
+    {
+        if(u + 1 < this->out_offsets.size()) {
+            for(uint64_t e = this->out_offsets[u]; e < this->out_offsets[u + 1];
+                e++) {
+                visit(this->out_targets[e]);
+            }
+        }
+        auto found = this->added_out.find(u);
+        if(found == this->added_out.end()) { return; }
+        for(uint32_t w : found->second) { visit(w); }
+    }
+
+    /* counting sort of (from, to) into rows keyed by to, or by from */
+    static void rows(const std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+                     uint64_t n, bool by_target, std::vector<uint64_t>& offsets,
+                     std::vector<uint32_t>& cells)
+    {
+        offsets.assign(n + 1, 0);
+        for(const std::pair<uint32_t, uint32_t>& edge : pairs) {
+            offsets[(by_target ? edge.second : edge.first) + 1]++;
+        }
+        for(uint64_t v = 0; v < n; v++) { offsets[v + 1] += offsets[v]; }
+        cells.resize(pairs.size());
+        std::vector<uint64_t> fill(offsets.begin(), offsets.end() - 1);
+        for(const std::pair<uint32_t, uint32_t>& edge : pairs) {
+            uint32_t row = by_target ? edge.second : edge.first;
+            cells[fill[row]++] = by_target ? edge.first : edge.second;
+        }
+    }
+
+    uint32_t iterate(const std::vector<uint64_t>& in_offsets,
+                     const std::vector<uint32_t>& in_sources)
+    {
+        uint64_t n = this->ids.size();
+        this->last_iterations = 0;
+        this->last_delta = 0;
+        this->total = 0;
+        if(n == 0 || this->max_iterations == 0) {
+            for(double score : this->scores) { this->total += score; }
+            return 0;
+        }
+
+        // targets split so every part pulls about the same number of edges
+        uint64_t parts = std::min<uint64_t>(this->workers, n);
+        uint64_t cost = in_sources.size() + n;
+        std::vector<uint64_t> pull_bounds(1, 0);
+        for(uint64_t v = 0; v < n && pull_bounds.size() < parts; v++) {
+            if(in_offsets[v + 1] + v + 1 >= cost * pull_bounds.size() / parts) {
+                pull_bounds.push_back(v + 1);
+            }
+        }
+        pull_bounds.push_back(n);
+        parts = pull_bounds.size() - 1;
+        // sources split evenly, they cost the same
+        std::vector<uint64_t> node_bounds;
+        for(uint64_t p = 0; p <= parts; p++) {
+            node_bounds.push_back(n * p / parts);
+        }
+
+        // per part sums, one set for even passes and one for odd passes so
+        // a fast worker never overwrites what a slow one is still reading
+        std::vector<double> contrib(n);
+        std::vector<double> next(n);
+        std::vector<double> change[2] = {std::vector<double>(parts),
+                                         std::vector<double>(parts)};
+        std::vector<double> sums[2] = {std::vector<double>(parts),
+                                       std::vector<double>(parts)};
+        worker_barrier barrier(static_cast<uint32_t>(parts));
+
+        // every worker runs the same passes and takes the same decision
+        auto work = [&](uint64_t p) {
+            std::vector<double>* from = &this->scores;
+            std::vector<double>* to = &next;
+            for(uint32_t pass = 0;; pass++) {
+                for(uint64_t u = node_bounds[p]; u < node_bounds[p + 1]; u++) {
+                    contrib[u] = this->out_degree[u] == 0
+                                     ? 0
+                                     : (*from)[u] / this->out_degree[u];
+                }
+                barrier.wait();
+
+                double moved = 0;
+                double sum = 0;
+                for(uint64_t v = pull_bounds[p]; v < pull_bounds[p + 1]; v++) {
+                    double pulled = 0;
+                    for(uint64_t e = in_offsets[v]; e < in_offsets[v + 1];
+                        e++) {
+                        pulled += contrib[in_sources[e]];
+                    }
+                    (*to)[v] = 1 + this->damping * pulled;
+                    moved += std::fabs((*to)[v] - (*from)[v]);
+                    sum += (*to)[v];
+                }
+                change[pass & 1][p] = moved;
+                sums[pass & 1][p] = sum;
+                barrier.wait();
+
+                double all_moved = 0;
+                double all_sum = 0;
+                for(uint64_t q = 0; q < parts; q++) {
+                    all_moved += change[pass & 1][q];
+                    all_sum += sums[pass & 1][q];
+                }
+                std::swap(from, to);
+                if(all_moved / all_sum < this->tolerance
+                   || pass + 1 == this->max_iterations) {
+                    if(p + 1 == parts) { // any one part will do
+                        this->last_iterations = pass + 1;
+                        this->last_delta = all_moved / all_sum;
+                        this->total = all_sum;
+                        if(from != &this->scores) { this->scores.swap(next); }
+                    }
+                    return;
+                }
+            }
+        };
+        this->pool.run(parts, work);
+
+        KS_COUNT(KS_RANK_ITERATIONS, this->last_iterations);
+        return this->last_iterations;
+    }
+};
+
+#endif // RANK_H
@@ -0,0 +1,735 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "content_store.h"
+#include "sys.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+/*
+ * on-disk snapshot layout (native endianness):
+ *
+ * | snapshot_header | snapshot_section[SEC_COUNT] | section data ... |
+ *
+ * every section is a flat array starting on an 8 byte boundary, and every
+ * reference inside the file is an offset or an index, never a pointer. the
+ * loader maps the file and answers queries straight out of the mapping, so
+ * startup only costs the pages that queries actually touch.
+ */
+
+enum snapshot_section_kind : uint32_t {
+    SEC_TAG_OFFSETS, // uint32_t[tags + 1], offsets into SEC_TAG_CHARS
+    SEC_TAG_CHARS, // tag names back to back
+    SEC_TAG_SORTED, // uint32_t[tags], symbols sorted by name
+    SEC_DOCS, // snapshot_doc[docs]
+    SEC_CONTENT, // document contents back to back
+    SEC_DOC_TAGS, // uint32_t tag symbols, sliced by snapshot_doc
+    SEC_DOC_REFS, // uint64_t refs, sliced by snapshot_doc
+    SEC_ID_INDEX, // snapshot_id_entry[], ascending id (the avl_tree)
+    SEC_POSTING_OFFSETS, // uint32_t[tags + 1], offsets into SEC_POSTINGS
+    SEC_POSTINGS, // uint32_t doc indexes (the hash_table)
+    SEC_HEAP, // uint32_t doc indexes in heap order (the priority_queue)
+    SEC_GRAPH_NODES, // uint64_t[nodes], ascending graph ids
+    SEC_GRAPH_OFFSETS, // uint32_t[nodes + 1], offsets into SEC_GRAPH_EDGES
+    SEC_GRAPH_EDGES, // uint32_t node indexes, forward edges
+    SEC_GRAPH_BACK_OFFSETS, // uint32_t[nodes + 1], reverse edges
+    SEC_GRAPH_BACK_EDGES, // uint32_t node indexes, reverse edges
+    SEC_COUNT
+};
+
+struct snapshot_header {
+    char magic[8]; // "KSSNAP\0\0"
+    uint32_t version;
+    uint32_t section_count;
+    uint64_t file_size;
+    uint64_t table_checksum; // covers the section table
+};
+
+struct snapshot_section {
+    uint64_t offset;
+    uint64_t length; // in bytes
+    uint64_t checksum; // covers the section data
+};
+
+struct snapshot_doc {
+    uint64_t id;
+    uint64_t content_off;
+    uint32_t content_len;
+    uint32_t tag_off;
+    uint32_t tag_count;
+    uint32_t ref_off;
+    uint32_t ref_count;
+    uint8_t priority;
+    uint8_t pad[3];
+};
+
+struct snapshot_id_entry {
+    uint64_t id;
+    uint32_t doc;
+    uint32_t pad;
+};
+
+static const char snapshot_magic[8] = {'K', 'S', 'S', 'N', 'A', 'P', 0, 0};
+static const uint32_t snapshot_version = 1;
+
+/* 64 bit fnv-1a */
+inline uint64_t snapshot_checksum(const uint8_t* data, uint64_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(uint64_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+class snapshot_writer {
+public:
+    /*
+     * writes the whole system into path. an existing file is replaced
+     * atomically, readers that have it mapped keep seeing the old one.
+     * contents is where compacted documents keep their bodies.
+     */
+    void write(const std::string& path, avl_tree& tree, hash_table& tags,
+               priority_queue& pq, knowledge_graph& graph,
+               content_store* contents = nullptr)
+    {
+        this->clear();
+
+        // the id index decides the document table, the other structures
+        // may still point at documents that were removed from the tree
+        std::vector<snapshot_id_entry> id_index;
+        tree.for_each([&](document* doc) {
+            snapshot_id_entry entry = {doc->id, this->add_doc(doc), 0};
+            id_index.push_back(entry);
+        });
+
+        tag_interner& interner = tag_interner::global();
+        uint32_t tag_count = interner.size();
+
+        // entries for anything else are dropped without touching the
+        // document, which the caller may already have freed
+        uint32_t index;
+        std::vector<std::vector<uint32_t>> postings(tag_count);
+        tags.for_each([&](uint32_t symbol, document* doc) {
+            if(this->known_doc(doc, index)) {
+                postings[symbol].push_back(index);
+            }
+        });
+
+        std::vector<uint32_t> heap;
+        pq.for_each([&](document* doc) {
+            if(this->known_doc(doc, index)) { heap.push_back(index); }
+        });
+        // dropping entries breaks the parent / child layout, rebuild it
+        std::make_heap(heap.begin(), heap.end(), [&](uint32_t a, uint32_t b) {
+            return this->docs[a]->priority > this->docs[b]->priority;
+        });
+
+        this->put_tags(interner, tag_count);
+        this->put_docs(contents);
+        this->put(SEC_ID_INDEX, id_index);
+        this->put_postings(postings);
+        this->put(SEC_HEAP, heap);
+        this->put_graph(graph);
+
+        this->flush(path);
+    }
+private:
+    std::vector<std::vector<uint8_t>> sections;
+    std::vector<document*> docs;
+    std::unordered_map<document*, uint32_t> doc_index;
+
+    void clear()
+    {
+        this->sections.assign(SEC_COUNT, std::vector<uint8_t>());
+        this->docs.clear();
+        this->doc_index.clear();
+    }
+
+    uint32_t add_doc(document* doc)
+    {
+        auto found = this->doc_index.find(doc);
+        if(found != this->doc_index.end()) { return found->second; }
+
+        uint32_t index = static_cast<uint32_t>(this->docs.size());
+        this->doc_index.emplace(doc, index);
+        this->docs.push_back(doc);
+        return index;
+    }
+
+    bool known_doc(document* doc, uint32_t& index)
+    {
+        auto found = this->doc_index.find(doc);
+        if(found == this->doc_index.end()) { return false; }
+        index = found->second;
+        return true;
+    }
+
+    template <typename T>
+    void put(snapshot_section_kind kind, const std::vector<T>& items)
+    {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(items.data());
+        this->sections[kind].assign(bytes, bytes + items.size() * sizeof(T));
+    }
+
+    /* turns a vector of vectors into offsets + one flat array */
+    void put_sliced(snapshot_section_kind offsets_kind,
+                    snapshot_section_kind items_kind,
+                    const std::vector<std::vector<uint32_t>>& slices)
+    {
+        std::vector<uint32_t> offsets(1, 0);
+        std::vector<uint32_t> items;
+        for(const std::vector<uint32_t>& slice : slices) {
+            items.insert(items.end(), slice.begin(), slice.end());
+            offsets.push_back(static_cast<uint32_t>(items.size()));
+        }
+        this->put(offsets_kind, offsets);
+        this->put(items_kind, items);
+    }
+
+    void put_tags(tag_interner& interner, uint32_t tag_count)
+    {
+        std::vector<uint32_t> offsets(1, 0);
+        std::vector<char> chars;
+        std::vector<uint32_t> sorted;
+        for(uint32_t symbol = 0; symbol < tag_count; symbol++) {
+            const std::string& name = interner.name(symbol);
+            chars.insert(chars.end(), name.begin(), name.end());
+            offsets.push_back(static_cast<uint32_t>(chars.size()));
+            sorted.push_back(symbol);
+        }
+        std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+            return interner.name(a) < interner.name(b);
+        });
+        this->put(SEC_TAG_OFFSETS, offsets);
+        this->put(SEC_TAG_CHARS, chars);
+        this->put(SEC_TAG_SORTED, sorted);
+    }
+
+    void put_docs(content_store* contents)
+    {
+        std::vector<snapshot_doc> records;
+        std::vector<char> content;
+        std::vector<uint32_t> doc_tags;
+        std::vector<uint64_t> doc_refs;
+        for(document* doc : this->docs) {
+            snapshot_doc record;
+            std::memset(&record, 0, sizeof(record));
+            record.id = doc->id;
+            record.priority = doc->priority;
+
+            std::string body = document_body(doc, contents);
+            record.content_off = content.size();
+            record.content_len = static_cast<uint32_t>(body.size());
+            content.insert(content.end(), body.begin(), body.end());
+
+            record.tag_off = static_cast<uint32_t>(doc_tags.size());
+            record.tag_count = doc->tags.size();
+            doc_tags.insert(doc_tags.end(), doc->tags.begin(), doc->tags.end());
+
+            record.ref_off = static_cast<uint32_t>(doc_refs.size());
+            record.ref_count = doc->refs.size();
+            doc_refs.insert(doc_refs.end(), doc->refs.begin(), doc->refs.end());
+
+            records.push_back(record);
+        }
+        this->put(SEC_DOCS, records);
+        this->put(SEC_CONTENT, content);
+        this->put(SEC_DOC_TAGS, doc_tags);
+        this->put(SEC_DOC_REFS, doc_refs);
+    }
+
+    void put_postings(std::vector<std::vector<uint32_t>>& postings)
+    {
+        for(std::vector<uint32_t>& posting : postings) {
+            std::sort(posting.begin(), posting.end());
+        }
+        this->put_sliced(SEC_POSTING_OFFSETS, SEC_POSTINGS, postings);
+    }
+
+    void put_graph(knowledge_graph& graph)
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> edges;
+        std::vector<uint64_t> nodes;
+        graph.for_each_reference([&](uint64_t from_id, uint64_t to_id) {
+            edges.push_back(std::make_pair(from_id, to_id));
+            nodes.push_back(from_id);
+            nodes.push_back(to_id);
+        });
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+        auto node_of = [&](uint64_t id) {
+            return static_cast<uint32_t>(
+                std::lower_bound(nodes.begin(), nodes.end(), id)
+                - nodes.begin());
+        };
+        std::vector<std::vector<uint32_t>> fwd(nodes.size());
+        std::vector<std::vector<uint32_t>> bwd(nodes.size());
+        for(const std::pair<uint64_t, uint64_t>& edge : edges) {
+            uint32_t from = node_of(edge.first);
+            uint32_t to = node_of(edge.second);
+            fwd[from].push_back(to);
+            bwd[to].push_back(from);
+        }
+        this->put(SEC_GRAPH_NODES, nodes);
+        this->put_sliced(SEC_GRAPH_OFFSETS, SEC_GRAPH_EDGES, fwd);
+        this->put_sliced(SEC_GRAPH_BACK_OFFSETS, SEC_GRAPH_BACK_EDGES, bwd);
+    }
+
+    void flush(const std::string& path)
+    {
+        snapshot_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version = snapshot_version;
+        header.section_count = SEC_COUNT;
+
+        snapshot_section table[SEC_COUNT];
+        uint64_t offset = sizeof(header) + sizeof(table);
+        for(uint32_t i = 0; i < SEC_COUNT; i++) {
+            offset = (offset + 7) & ~uint64_t(7);
+            table[i].offset = offset;
+            table[i].length = this->sections[i].size();
+            table[i].checksum = snapshot_checksum(this->sections[i].data(),
+                                                  this->sections[i].size());
+            offset += table[i].length;
+        }
+        header.file_size = offset;
+        header.table_checksum = snapshot_checksum(
+            reinterpret_cast<const uint8_t*>(table), sizeof(table));
+
+        // the file is built next to path and renamed over it once it is
+        // durable: a process serving from a mapping of the old file keeps
+        // its inode, and a crash midway leaves the old snapshot intact
+        std::string tmp_path = path + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            throw std::runtime_error("ERR: CANNOT OPEN SNAPSHOT FOR WRITING.");
+        }
+        bool ok = write_all(fd, &header, sizeof(header))
+                  && write_all(fd, table, sizeof(table));
+        uint64_t written = sizeof(header) + sizeof(table);
+        const char zeros[8] = {0};
+        for(uint32_t i = 0; ok && i < SEC_COUNT; i++) {
+            ok = write_all(fd, zeros, table[i].offset - written)
+                 && write_all(fd, this->sections[i].data(), table[i].length);
+            written = table[i].offset + table[i].length;
+        }
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if(!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            unlink(tmp_path.c_str());
+            throw std::runtime_error("ERR: SNAPSHOT WRITE FAILED.");
+        }
+        sync_parent(path);
+    }
+
+    static bool write_all(int fd, const void* data, uint64_t length)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while(length > 0) {
+            ssize_t n = ::write(fd, bytes, length);
+            if(n < 0 && errno == EINTR) { continue; }
+            if(n <= 0) { return false; }
+            bytes += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    /* makes the rename itself durable */
+    static void sync_parent(const std::string& path)
+    {
+        uint64_t slash = path.find_last_of('/');
+        std::string dir =
+            slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if(fd < 0) {
+            throw std::runtime_error("ERR: CANNOT SYNC SNAPSHOT DIRECTORY.");
+        }
+        bool ok = fsync(fd) == 0;
+        close(fd);
+        if(!ok) {
+            throw std::runtime_error("ERR: CANNOT SYNC SNAPSHOT DIRECTORY.");
+        }
+    }
+};
+
+class snapshot {
+public:
+    /* a read-only document living inside the mapping */
+    struct doc_view {
+        uint64_t id;
+        uint8_t priority;
+        std::string_view content;
+        const uint32_t* tags; // snapshot tag symbols, see tag_name()
+        uint32_t tag_count;
+        const uint64_t* refs;
+        uint32_t ref_count;
+    };
+
+    snapshot(const std::string& path): base(nullptr), length(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) { throw std::runtime_error("ERR: CANNOT OPEN SNAPSHOT."); }
+
+        struct stat info;
+        if(fstat(fd, &info) != 0
+           || static_cast<uint64_t>(info.st_size) < sizeof(snapshot_header)) {
+            close(fd);
+            throw std::runtime_error("ERR: SNAPSHOT IS TRUNCATED.");
+        }
+        this->length = info.st_size;
+
+        void* mapping =
+            mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            throw std::runtime_error("ERR: CANNOT MAP SNAPSHOT.");
+        }
+        this->base = static_cast<const uint8_t*>(mapping);
+        // queries jump around the file, read-ahead would only waste io
+        madvise(mapping, this->length, MADV_RANDOM);
+
+        try {
+            this->validate();
+        }
+        catch(...) {
+            munmap(mapping, this->length);
+            throw;
+        }
+    } // maps the file and checks that every section is laid out sanely
+
+    ~snapshot()
+    {
+        if(this->base != nullptr) {
+            munmap(const_cast<uint8_t*>(this->base), this->length);
+        }
+    }
+
+    snapshot(const snapshot&) = delete;
+    snapshot& operator=(const snapshot&) = delete;
+
+    /* checks every section checksum, this reads the whole file */
+    bool verify()
+    {
+        for(uint32_t i = 0; i < SEC_COUNT; i++) {
+            const snapshot_section& section = this->table[i];
+            if(snapshot_checksum(this->base + section.offset, section.length)
+               != section.checksum) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t document_count() { return this->count<snapshot_doc>(SEC_DOCS); }
+
+    bool find(uint64_t id, doc_view& out)
+    {
+        const snapshot_id_entry* first = this->items<snapshot_id_entry>(
+            SEC_ID_INDEX);
+        const snapshot_id_entry* last =
+            first + this->count<snapshot_id_entry>(SEC_ID_INDEX);
+        const snapshot_id_entry* found = std::lower_bound(
+            first, last, id,
+            [](const snapshot_id_entry& entry, uint64_t key) {
+                return entry.id < key;
+            });
+        if(found == last || found->id != id) { return false; }
+        out = this->view(found->doc);
+        return true;
+    }
+
+    std::vector<doc_view> search(const std::string& tag)
+    {
+        std::vector<doc_view> ret_vec;
+        uint32_t symbol;
+        if(!this->lookup_tag(tag, symbol)) { return ret_vec; }
+
+        const uint32_t* offsets = this->items<uint32_t>(SEC_POSTING_OFFSETS);
+        const uint32_t* postings = this->items<uint32_t>(SEC_POSTINGS);
+        for(uint32_t i = offsets[symbol]; i < offsets[symbol + 1]; i++) {
+            ret_vec.push_back(this->view(postings[i]));
+        }
+        return ret_vec;
+    }
+
+    /* the task priority_queue::get_next_task would return next */
+    bool peek_next_task(doc_view& out)
+    {
+        if(this->count<uint32_t>(SEC_HEAP) == 0) { return false; }
+        out = this->view(this->items<uint32_t>(SEC_HEAP)[0]);
+        return true;
+    }
+
+    std::string_view tag_name(uint32_t symbol)
+    {
+        // symbols come from callers too, not only from validated sections
+        if(symbol >= this->count<uint32_t>(SEC_TAG_SORTED)) {
+            throw std::runtime_error("ERR: UNKNOWN SNAPSHOT TAG SYMBOL.");
+        }
+        const uint32_t* offsets = this->items<uint32_t>(SEC_TAG_OFFSETS);
+        const char* chars = this->items<char>(SEC_TAG_CHARS);
+        return std::string_view(chars + offsets[symbol],
+                                offsets[symbol + 1] - offsets[symbol]);
+    }
+
+    std::vector<uint64_t> get_backlinks(uint64_t id)
+    {
+        std::vector<uint64_t> ret_vec;
+        uint32_t node;
+        if(!this->lookup_node(id, node)) { return ret_vec; }
+
+        const uint64_t* nodes = this->items<uint64_t>(SEC_GRAPH_NODES);
+        const uint32_t* offsets =
+            this->items<uint32_t>(SEC_GRAPH_BACK_OFFSETS);
+        const uint32_t* edges = this->items<uint32_t>(SEC_GRAPH_BACK_EDGES);
+        for(uint32_t i = offsets[node]; i < offsets[node + 1]; i++) {
+            ret_vec.push_back(nodes[edges[i]]);
+        }
+        return ret_vec;
+    }
+
+    /* same bidirectional search as knowledge_graph::is_reachable */
+    bool is_reachable(uint64_t source_id, uint64_t target_id)
+    {
+        if(source_id == target_id) { return true; }
+
+        uint32_t source;
+        uint32_t target;
+        if(!this->lookup_node(source_id, source)
+           || !this->lookup_node(target_id, target)) {
+            return false;
+        }
+
+        std::unordered_set<uint32_t> fwd_visited = {source};
+        std::unordered_set<uint32_t> bwd_visited = {target};
+        std::vector<uint32_t> fwd_frontier(1, source);
+        std::vector<uint32_t> bwd_frontier(1, target);
+
+        while(!fwd_frontier.empty() && !bwd_frontier.empty()) {
+            bool met;
+            if(fwd_frontier.size() <= bwd_frontier.size()) {
+                met = this->expand(SEC_GRAPH_OFFSETS, SEC_GRAPH_EDGES,
+                                   fwd_frontier, fwd_visited, bwd_visited);
+            }
+            else {
+                met = this->expand(SEC_GRAPH_BACK_OFFSETS,
+                                   SEC_GRAPH_BACK_EDGES, bwd_frontier,
+                                   bwd_visited, fwd_visited);
+            }
+            if(met) { return true; }
+        }
+        return false;
+    }
+private:
+    const uint8_t* base;
+    uint64_t length;
+    const snapshot_section* table;
+
+    void validate()
+    {
+        const snapshot_header* header =
+            reinterpret_cast<const snapshot_header*>(this->base);
+        if(std::memcmp(header->magic, snapshot_magic, sizeof(header->magic))
+           != 0) {
+            throw std::runtime_error("ERR: NOT A SNAPSHOT FILE.");
+        }
+        if(header->version != snapshot_version) {
+            throw std::runtime_error("ERR: UNSUPPORTED SNAPSHOT VERSION.");
+        }
+        uint64_t table_end =
+            sizeof(snapshot_header) + SEC_COUNT * sizeof(snapshot_section);
+        if(header->section_count != SEC_COUNT || header->file_size != length
+           || this->length < table_end) {
+            throw std::runtime_error("ERR: SNAPSHOT IS TRUNCATED.");
+        }
+
+        this->table = reinterpret_cast<const snapshot_section*>(
+            this->base + sizeof(snapshot_header));
+        if(snapshot_checksum(reinterpret_cast<const uint8_t*>(this->table),
+                             SEC_COUNT * sizeof(snapshot_section))
+           != header->table_checksum) {
+            throw std::runtime_error("ERR: SNAPSHOT SECTION TABLE IS CORRUPT.");
+        }
+        for(uint32_t i = 0; i < SEC_COUNT; i++) {
+            const snapshot_section& section = this->table[i];
+            if(section.offset % 8 != 0 || section.offset < table_end
+               || section.offset + section.length > this->length) {
+                throw std::runtime_error("ERR: SNAPSHOT SECTION OUT OF RANGE.");
+            }
+        }
+        this->validate_sections();
+    }
+
+    /*
+     * the checksums are only read by verify(), so a damaged or hostile file
+     * could still hand out offsets and indexes that point past a section.
+     * every one of them is checked once here, which lets the queries trust
+     * the data without a check per dereference.
+     */
+    void validate_sections()
+    {
+        static const uint64_t sizes[SEC_COUNT] = {
+            sizeof(uint32_t), 1, sizeof(uint32_t), sizeof(snapshot_doc), 1,
+            sizeof(uint32_t), sizeof(uint64_t), sizeof(snapshot_id_entry),
+            sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+            sizeof(uint64_t), sizeof(uint32_t), sizeof(uint32_t),
+            sizeof(uint32_t), sizeof(uint32_t)};
+        for(uint32_t i = 0; i < SEC_COUNT; i++) {
+            corrupt_unless(this->table[i].length % sizes[i] == 0);
+        }
+
+        uint64_t tags = this->count<uint32_t>(SEC_TAG_SORTED);
+        uint64_t docs = this->count<snapshot_doc>(SEC_DOCS);
+        uint64_t nodes = this->count<uint64_t>(SEC_GRAPH_NODES);
+
+        this->check_offsets(SEC_TAG_OFFSETS, tags,
+                            this->count<char>(SEC_TAG_CHARS));
+        this->check_indexes(SEC_TAG_SORTED, tags);
+
+        uint64_t content = this->count<char>(SEC_CONTENT);
+        uint64_t doc_tags = this->count<uint32_t>(SEC_DOC_TAGS);
+        uint64_t doc_refs = this->count<uint64_t>(SEC_DOC_REFS);
+        const snapshot_doc* records = this->items<snapshot_doc>(SEC_DOCS);
+        for(uint64_t i = 0; i < docs; i++) {
+            const snapshot_doc& record = records[i];
+            corrupt_unless(record.content_off <= content
+                           && record.content_len
+                              <= content - record.content_off);
+            corrupt_unless(record.tag_off <= doc_tags
+                           && record.tag_count <= doc_tags - record.tag_off);
+            corrupt_unless(record.ref_off <= doc_refs
+                           && record.ref_count <= doc_refs - record.ref_off);
+        }
+        this->check_indexes(SEC_DOC_TAGS, tags);
+
+        const snapshot_id_entry* id_index =
+            this->items<snapshot_id_entry>(SEC_ID_INDEX);
+        for(uint64_t i = 0; i < this->count<snapshot_id_entry>(SEC_ID_INDEX);
+            i++) {
+            corrupt_unless(id_index[i].doc < docs);
+        }
+
+        this->check_offsets(SEC_POSTING_OFFSETS, tags,
+                            this->count<uint32_t>(SEC_POSTINGS));
+        this->check_indexes(SEC_POSTINGS, docs);
+        this->check_indexes(SEC_HEAP, docs);
+
+        this->check_offsets(SEC_GRAPH_OFFSETS, nodes,
+                            this->count<uint32_t>(SEC_GRAPH_EDGES));
+        this->check_indexes(SEC_GRAPH_EDGES, nodes);
+        this->check_offsets(SEC_GRAPH_BACK_OFFSETS, nodes,
+                            this->count<uint32_t>(SEC_GRAPH_BACK_EDGES));
+        this->check_indexes(SEC_GRAPH_BACK_EDGES, nodes);
+    }
+
+    /* slices offsets: slices + 1 entries, ascending, ending inside items */
+    void check_offsets(snapshot_section_kind kind, uint64_t slices,
+                       uint64_t items)
+    {
+        corrupt_unless(this->count<uint32_t>(kind) == slices + 1);
+        const uint32_t* offsets = this->items<uint32_t>(kind);
+        for(uint64_t i = 0; i < slices; i++) {
+            corrupt_unless(offsets[i] <= offsets[i + 1]);
+        }
+        corrupt_unless(offsets[slices] <= items);
+    }
+
+    /* every uint32_t in the section has to be below limit */
+    void check_indexes(snapshot_section_kind kind, uint64_t limit)
+    {
+        const uint32_t* indexes = this->items<uint32_t>(kind);
+        for(uint64_t i = 0; i < this->count<uint32_t>(kind); i++) {
+            corrupt_unless(indexes[i] < limit);
+        }
+    }
+
+    static void corrupt_unless(bool sane)
+    {
+        if(!sane) { throw std::runtime_error("ERR: CORRUPT SNAPSHOT."); }
+    }
+
+    template <typename T> const T* items(snapshot_section_kind kind)
+    {
+        return reinterpret_cast<const T*>(this->base
+                                          + this->table[kind].offset);
+    }
+    template <typename T> uint64_t count(snapshot_section_kind kind)
+    {
+        return this->table[kind].length / sizeof(T);
+    }
+
+    doc_view view(uint32_t index)
+    {
+        corrupt_unless(index < this->count<snapshot_doc>(SEC_DOCS));
+        const snapshot_doc& record = this->items<snapshot_doc>(SEC_DOCS)[index];
+        doc_view ret;
+        ret.id = record.id;
+        ret.priority = record.priority;
+        ret.content = std::string_view(
+            this->items<char>(SEC_CONTENT) + record.content_off,
+            record.content_len);
+        ret.tags = this->items<uint32_t>(SEC_DOC_TAGS) + record.tag_off;
+        ret.tag_count = record.tag_count;
+        ret.refs = this->items<uint64_t>(SEC_DOC_REFS) + record.ref_off;
+        ret.ref_count = record.ref_count;
+        return ret;
+    }
+
+    bool lookup_tag(const std::string& tag, uint32_t& symbol)
+    {
+        const uint32_t* first = this->items<uint32_t>(SEC_TAG_SORTED);
+        const uint32_t* last = first + this->count<uint32_t>(SEC_TAG_SORTED);
+        const uint32_t* found = std::lower_bound(
+            first, last, tag, [&](uint32_t candidate, const std::string& key) {
+                return this->tag_name(candidate) < key;
+            });
+        if(found == last || this->tag_name(*found) != tag) { return false; }
+        symbol = *found;
+        return true;
+    }
+
+    bool lookup_node(uint64_t id, uint32_t& node)
+    {
+        const uint64_t* first = this->items<uint64_t>(SEC_GRAPH_NODES);
+        const uint64_t* last = first + this->count<uint64_t>(SEC_GRAPH_NODES);
+        const uint64_t* found = std::lower_bound(first, last, id);
+        if(found == last || *found != id) { return false; }
+        node = static_cast<uint32_t>(found - first);
+        return true;
+    }
+
+    bool expand(snapshot_section_kind offsets_kind,
+                snapshot_section_kind edges_kind,
+                std::vector<uint32_t>& frontier,
+                std::unordered_set<uint32_t>& own_visited,
+                std::unordered_set<uint32_t>& other_visited)
+    {
+        const uint32_t* offsets = this->items<uint32_t>(offsets_kind);
+        const uint32_t* edges = this->items<uint32_t>(edges_kind);
+        std::vector<uint32_t> next_frontier;
+        for(uint32_t node : frontier) {
+            for(uint32_t i = offsets[node]; i < offsets[node + 1]; i++) {
+                uint32_t next = edges[i];
+                if(other_visited.count(next) != 0) { return true; }
+                if(own_visited.insert(next).second) {
+                    next_frontier.push_back(next);
+                }
+            }
+        }
+        frontier.swap(next_frontier);
+        return false;
+    }
+};
+
+#endif // SNAPSHOT_H
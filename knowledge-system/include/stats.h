@@ -0,0 +1,332 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * hot-path counters and per-operation latency histograms.
+ *
+ * every thread writes into its own block of counters and histograms, so the
+ * hot path never shares a cache line or takes a lock. stats() merges the
+ * blocks of live threads with whatever exited threads left behind.
+ *
+ * build with -DKS_NO_STATS and KS_COUNT / KS_TIME compile to nothing.
+ */
+
+enum ks_counter : uint32_t {
+    KS_AVL_ROTATIONS, // rotate_left + rotate_right
+    KS_HASH_CHAIN_STEPS, // hash_node visits in hash_table::search
+    KS_HEAP_SWAPS, // swaps in heapify_up + heapify_down
+    KS_GRAPH_NODES_VISITED, // nodes expanded by is_reachable
+    KS_GRAPH_CHAIN_STEPS, // graph_node visits while locating a node
+    KS_TEXT_DOCS_SCORED, // documents fully scored by fulltext search
+    KS_CONTENT_CACHE_MISSES, // blocks decompressed by content_store
+    KS_TAG_CONTENDED_LOCKS, // tag_index shard locks found already held
+    KS_RANK_ITERATIONS, // passes over the graph by page_rank
+    KS_RANK_PUSHES, // residual pushes by page_rank::update
+    KS_COUNTER_COUNT
+};
+
+enum ks_op : uint32_t {
+    KS_AVL_INSERT,
+    KS_AVL_REMOVE,
+    KS_AVL_FIND,
+    KS_AVL_FIND_BATCH,
+    KS_HASH_INSERT,
+    KS_HASH_REMOVE,
+    KS_HASH_SEARCH,
+    KS_TAGS_INSERT,
+    KS_TAGS_REMOVE,
+    KS_TAGS_SEARCH,
+    KS_PQ_ADD,
+    KS_PQ_NEXT,
+    KS_PQ_REMOVE,
+    KS_GRAPH_ADD_REF,
+    KS_GRAPH_REMOVE,
+    KS_GRAPH_BACKLINKS,
+    KS_GRAPH_REACHABLE,
+    KS_RANK_COMPUTE,
+    KS_RANK_UPDATE,
+    KS_TEXT_ADD,
+    KS_TEXT_SEARCH,
+    KS_CONTENT_PUT,
+    KS_CONTENT_GET,
+    KS_STORE_INGEST,
+    KS_STORE_REMOVE,
+    KS_OP_COUNT
+};
+
+inline const char* ks_counter_name(uint32_t counter)
+{
+    static const char* names[KS_COUNTER_COUNT] = {
+        "avl_tree.rotations",
+        "hash_table.chain_steps",
+        "priority_queue.swaps",
+        "knowledge_graph.nodes_visited",
+        "knowledge_graph.chain_steps",
+        "fulltext_index.docs_scored",
+        "content_store.cache_misses",
+        "tag_index.contended_locks",
+        "page_rank.iterations",
+        "page_rank.pushes"};
+    return names[counter];
+}
+
+inline const char* ks_op_name(uint32_t op)
+{
+    static const char* names[KS_OP_COUNT] = {
+        "avl_tree.insert",
+        "avl_tree.remove",
+        "avl_tree.find",
+        "avl_tree.find_batch",
+        "hash_table.insert",
+        "hash_table.remove",
+        "hash_table.search",
+        "tag_index.insert",
+        "tag_index.remove",
+        "tag_index.search",
+        "priority_queue.add_new_task",
+        "priority_queue.get_next_task",
+        "priority_queue.remove",
+        "knowledge_graph.add_reference",
+        "knowledge_graph.remove_document",
+        "knowledge_graph.get_backlinks",
+        "knowledge_graph.is_reachable",
+        "page_rank.compute",
+        "page_rank.update",
+        "fulltext_index.add",
+        "fulltext_index.search",
+        "content_store.put",
+        "content_store.get",
+        "document_store.ingest",
+        "document_store.remove"};
+    return names[op];
+}
+
+class ks_histogram {
+    // hdr style log-linear buckets: values below 16 get a bucket each, above
+    // that every power of two is split into 16 equal buckets, which keeps the
+    // relative error of any reported quantile under 6.25%.
+public:
+    static constexpr uint32_t sub_bits = 4;
+    static constexpr uint32_t sub_count = 1 << sub_bits;
+    static constexpr uint32_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+    static uint32_t bucket_of(uint64_t value)
+    {
+        if(value < sub_count) { return static_cast<uint32_t>(value); }
+        uint32_t shift = 63 - __builtin_clzll(value) - sub_bits;
+        return (shift + 1) * sub_count
+               + static_cast<uint32_t>(value >> shift) - sub_count;
+    }
+    /* the largest value that lands in bucket */
+    static uint64_t upper_of(uint32_t bucket)
+    {
+        if(bucket < sub_count) { return bucket; }
+        uint32_t shift = bucket / sub_count - 1;
+        uint64_t mantissa = bucket % sub_count + sub_count;
+        return ((mantissa + 1) << shift) - 1;
+    }
+};
+
+/* one thread's share, written by that thread only */
+struct ks_thread_stats {
+    std::atomic<uint64_t> counters[KS_COUNTER_COUNT];
+    std::atomic<uint64_t> buckets[KS_OP_COUNT][ks_histogram::bucket_count];
+
+    ks_thread_stats() { this->clear(); }
+
+    void clear()
+    {
+        for(std::atomic<uint64_t>& counter : this->counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        for(auto& op : this->buckets) {
+            for(std::atomic<uint64_t>& bucket : op) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /* the owner is the only writer, a plain load + store is enough */
+    static void bump(std::atomic<uint64_t>& slot, uint64_t n)
+    {
+        slot.store(slot.load(std::memory_order_relaxed) + n,
+                   std::memory_order_relaxed);
+    }
+
+    void merge_into(std::vector<uint64_t>& counters,
+                    std::vector<uint64_t>& buckets)
+    {
+        for(uint32_t i = 0; i < KS_COUNTER_COUNT; i++) {
+            counters[i] += this->counters[i].load(std::memory_order_relaxed);
+        }
+        for(uint32_t op = 0; op < KS_OP_COUNT; op++) {
+            for(uint32_t b = 0; b < ks_histogram::bucket_count; b++) {
+                buckets[op * ks_histogram::bucket_count + b] +=
+                    this->buckets[op][b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+class ks_stats {
+public:
+    static ks_stats& global()
+    {
+        // never destroyed, threads may still retire during static teardown
+        static ks_stats* instance = new ks_stats();
+        return *instance;
+    }
+
+    void count(ks_counter counter, uint64_t n)
+    {
+        ks_thread_stats::bump(this->local().counters[counter], n);
+    }
+    void record(ks_op op, uint64_t nanos)
+    {
+        ks_thread_stats::bump(
+            this->local().buckets[op][ks_histogram::bucket_of(nanos)], 1);
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->retired_counters.assign(KS_COUNTER_COUNT, 0);
+        this->retired_buckets.assign(KS_OP_COUNT * ks_histogram::bucket_count,
+                                     0);
+        for(ks_thread_stats* stats : this->threads) { stats->clear(); }
+    }
+
+    /*
+     * {"counters": {name: total, ...},
+     *  "ops": {name: {"count", "p50_ns", "p99_ns", "p999_ns", "max_ns"}, ...}}
+     * ops that never ran are left out.
+     */
+    std::string json()
+    {
+        std::vector<uint64_t> counters;
+        std::vector<uint64_t> buckets;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            counters = this->retired_counters;
+            buckets = this->retired_buckets;
+            for(ks_thread_stats* stats : this->threads) {
+                stats->merge_into(counters, buckets);
+            }
+        }
+
+        std::ostringstream out;
+        out << "{\"counters\": {";
+        for(uint32_t i = 0; i < KS_COUNTER_COUNT; i++) {
+            out << (i == 0 ? "" : ", ") << "\"" << ks_counter_name(i)
+                << "\": " << counters[i];
+        }
+        out << "}, \"ops\": {";
+        bool first = true;
+        for(uint32_t op = 0; op < KS_OP_COUNT; op++) {
+            const uint64_t* hist = &buckets[op * ks_histogram::bucket_count];
+            uint64_t total = 0;
+            for(uint32_t b = 0; b < ks_histogram::bucket_count; b++) {
+                total += hist[b];
+            }
+            if(total == 0) { continue; }
+
+            out << (first ? "" : ", ") << "\"" << ks_op_name(op)
+                << "\": {\"count\": " << total
+                << ", \"p50_ns\": " << quantile(hist, total, 0.5)
+                << ", \"p99_ns\": " << quantile(hist, total, 0.99)
+                << ", \"p999_ns\": " << quantile(hist, total, 0.999)
+                << ", \"max_ns\": " << quantile(hist, total, 1.0) << "}";
+            first = false;
+        }
+        out << "}}";
+        return out.str();
+    }
+private:
+    std::mutex lock;
+    std::vector<ks_thread_stats*> threads;
+    std::vector<uint64_t> retired_counters;
+    std::vector<uint64_t> retired_buckets;
+
+    ks_stats()
+        : retired_counters(KS_COUNTER_COUNT, 0),
+          retired_buckets(KS_OP_COUNT * ks_histogram::bucket_count, 0)
+    {}
+
+    /* hands the thread's numbers over when it exits */
+    struct thread_slot {
+        ks_thread_stats* stats;
+
+        thread_slot(): stats(new ks_thread_stats())
+        {
+            ks_stats& owner = ks_stats::global();
+            std::lock_guard<std::mutex> guard(owner.lock);
+            owner.threads.push_back(this->stats);
+        }
+        ~thread_slot()
+        {
+            ks_stats& owner = ks_stats::global();
+            std::lock_guard<std::mutex> guard(owner.lock);
+            this->stats->merge_into(owner.retired_counters,
+                                    owner.retired_buckets);
+            owner.threads.erase(std::find(owner.threads.begin(),
+                                          owner.threads.end(), this->stats));
+            delete this->stats;
+        }
+    };
+
+    ks_thread_stats& local()
+    {
+        static thread_local thread_slot slot;
+        return *slot.stats;
+    }
+
+    static uint64_t quantile(const uint64_t* hist, uint64_t total, double q)
+    {
+        uint64_t rank = static_cast<uint64_t>(q * total);
+        if(rank == 0) { rank = 1; }
+        uint64_t seen = 0;
+        uint32_t last = 0;
+        for(uint32_t b = 0; b < ks_histogram::bucket_count; b++) {
+            if(hist[b] == 0) { continue; }
+            last = b;
+            seen += hist[b];
+            if(seen >= rank) { return ks_histogram::upper_of(b); }
+        }
+        return ks_histogram::upper_of(last);
+    }
+};
+
+/* records how long the enclosing scope took */
+class ks_scoped_timer {
+public:
+    ks_scoped_timer(ks_op op): op(op), start(std::chrono::steady_clock::now())
+    {}
+    ~ks_scoped_timer()
+    {
+        std::chrono::nanoseconds took =
+            std::chrono::steady_clock::now() - this->start;
+        ks_stats::global().record(this->op, took.count());
+    }
+private:
+    ks_op op;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifndef KS_NO_STATS
+#define KS_COUNT(counter, n) ks_stats::global().count(counter, n)
+#define KS_TIME(op) ks_scoped_timer ks_op_timer(op)
+#else
+#define KS_COUNT(counter, n) ((void)(n))
+#define KS_TIME(op) ((void)0)
+#endif
+
+#endif // STATS_H
@@ -1,32 +1,176 @@
+#ifndef SYS_H
+#define SYS_H
+
 #include <algorithm>
 #include <cmath>
 #include <cstdarg>
 #include <cstdint>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
 #include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
+#include "stats.h"
+
+class tag_interner {
+    // maps every distinct tag string to a dense uint32_t symbol, so that each
+    // tag is stored once and tag comparisons become integer comparisons.
+    // safe to share between threads, ingest workers intern concurrently.
+public:
+    static tag_interner& global()
+    {
+        static tag_interner instance;
+        return instance;
+    }
+
+    uint32_t intern(const std::string& tag)
+    {
+        uint32_t symbol;
+        if(this->lookup(tag, symbol)) { return symbol; }
+
+        std::unique_lock<std::shared_mutex> guard(this->lock);
+        // another thread may have interned it between the two locks
+        auto found = this->symbols.find(tag);
+        if(found != this->symbols.end()) { return found->second; }
+
+        symbol = static_cast<uint32_t>(this->names.size());
+        auto inserted = this->symbols.emplace(tag, symbol).first;
+        // keys of an unordered_map never move, so point straight at them
+        this->names.push_back(&inserted->first);
+        return symbol;
+    }
+    bool lookup(const std::string& tag, uint32_t& symbol)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        auto found = this->symbols.find(tag);
+        if(found == this->symbols.end()) { return false; }
+        symbol = found->second;
+        return true;
+    }
+    const std::string& name(uint32_t symbol)
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return *this->names[symbol];
+    }
+    uint32_t size()
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        return static_cast<uint32_t>(this->names.size());
+    }
+private:
+    std::shared_mutex lock;
+    std::unordered_map<std::string, uint32_t> symbols;
+    std::vector<const std::string*> names;
+};
+
+template <typename T, uint32_t N>
+class small_vector {
+    // keeps up to N elements inline in the object itself and only moves them
+    // to the heap once it grows past that, most documents never allocate.
+public:
+    small_vector(): count(0), capacity(N) {}
+    ~small_vector()
+    {
+        if(this->capacity > N) { delete[] this->heap_buf; }
+    }
+
+    small_vector(const small_vector& original): count(0), capacity(N)
+    {
+        for(const T& item : original) { this->push_back(item); }
+    } // copy constructor
+
+    small_vector& operator=(const small_vector& original)
+    {
+        if(this != &original) { // self-assignment check
+            this->count = 0;
+            for(const T& item : original) { this->push_back(item); }
+        }
+        return *this;
+    } // overloaded assignment operator
+
+    void push_back(T item)
+    {
+        if(this->count == this->capacity) { this->grow(); }
+        this->data()[this->count++] = item;
+    }
+
+    T* data() { return this->capacity > N ? this->heap_buf : this->inline_buf; }
+    const T* data() const
+    {
+        return this->capacity > N ? this->heap_buf : this->inline_buf;
+    }
+    uint32_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+
+    T& operator[](uint32_t i) { return this->data()[i]; }
+    const T& operator[](uint32_t i) const { return this->data()[i]; }
+    T* begin() { return this->data(); }
+    T* end() { return this->data() + this->count; }
+    const T* begin() const { return this->data(); }
+    const T* end() const { return this->data() + this->count; }
+private:
+    union {
+        T inline_buf[N];
+        T* heap_buf;
+    };
+    uint32_t count;
+    uint32_t capacity;
+
+    void grow()
+    {
+        T* new_buf = new T[this->capacity * 2];
+        std::copy(this->begin(), this->end(), new_buf);
+        if(this->capacity > N) { delete[] this->heap_buf; }
+        this->heap_buf = new_buf;
+        this->capacity *= 2;
+    }
+};
+
 class document {
 public:
     uint64_t id;
     uint8_t priority;
+    uint32_t content_handle; // set once a content_store owns the content
     std::string content;
-    std::vector<std::string> tags;
-    std::vector<uint64_t> refs;
+    small_vector<uint32_t, 4> tags; // interned tag symbols
+    small_vector<uint64_t, 2> refs;
 
-    document(uint64_t id, std::string content): id(id), content(content) {}
+    static const uint32_t inline_content = UINT32_MAX;
 
-    void add_tag(std::string tag) { this->tags.push_back(tag); }
+    document(uint64_t id, std::string content)
+        : id(id), content_handle(inline_content), content(content)
+    {}
+
+    void add_tag(const std::string& tag)
+    {
+        this->tags.push_back(tag_interner::global().intern(tag));
+    }
     void add_ref(uint64_t ref) { this->refs.push_back(ref); }
 
+    const std::string& tag_name(uint32_t i)
+    {
+        return tag_interner::global().name(this->tags[i]);
+    }
+
+    /* a compacted body lives in its content_store, display through that */
     void display()
+    {
+        if(this->content_handle != inline_content) {
+            throw std::logic_error(
+                "ERR: DOCUMENT CONTENT IS IN A CONTENT STORE.");
+        }
+        this->display(this->content);
+    }
+    void display(const std::string& body)
     {
         std::cout << "\nDoc ID: " << this->id << "\n"
                   << "Content:\n"
                   << "--- DOC START ---\n"
-                  << this->content << "\n"
+                  << body << "\n"
                   << "---- DOC END ----\n";
     }
 };
@@ -34,12 +178,13 @@ public:
 class avl_node {
 private:
     int64_t height;
+    uint64_t key; // data->id, kept here so a descent never leaves the node
     document* data;
     avl_node* lhs;
     avl_node* rhs;
 public:
     avl_node(document* data) // avl node constructor
-        : height(0), data(data), lhs(nullptr), rhs(nullptr)
+        : height(0), key(data->id), data(data), lhs(nullptr), rhs(nullptr)
     {}
 
     friend class avl_tree;
@@ -52,6 +197,7 @@ public:
 
     void insert(document* doc)
     {
+        KS_TIME(KS_AVL_INSERT);
         if(this->root == nullptr) { this->root = this->insert(nullptr, doc); }
         else {
             this->root = this->insert(this->root, doc);
@@ -59,14 +205,91 @@ public:
     }
     document* remove(uint64_t id)
     {
+        KS_TIME(KS_AVL_REMOVE);
         document* doc = nullptr;
         this->root = this->remove(this->root, id, doc);
         return doc;
     }
-    document* find(uint64_t id) { return this->find(this->root, id); }
+    document* find(uint64_t id)
+    {
+        KS_TIME(KS_AVL_FIND);
+        return this->find(this->root, id);
+    }
+
+    /*
+     * out[i] = find(ids[i]) for every i < count. a lone descent stalls on a
+     * cache miss at every level, so up to batch_window descents run
+     * interleaved instead: each one takes a single step, prefetches the node
+     * it moves to and yields to the next, and by the time it comes round
+     * again that node has arrived. a finished slot picks up the next id, so
+     * the window stays full until the batch runs dry.
+     */
+    void find_batch(const uint64_t* ids, uint64_t count, document** out)
+    {
+        KS_TIME(KS_AVL_FIND_BATCH);
+        struct descent {
+            avl_node* node;
+            uint64_t at; // position in ids
+        };
+        descent window[batch_window];
+        uint64_t next = 0;
+        uint32_t active = 0;
+        while(active < batch_window && next < count) {
+            __builtin_prefetch(this->root);
+            window[active].node = this->root;
+            window[active].at = next++;
+            active++;
+        }
+
+        while(active > 0) {
+            for(uint32_t i = 0; i < active;) {
+                descent& curr = window[i];
+                avl_node* node = curr.node;
+                uint64_t id = ids[curr.at];
+                if(node != nullptr && node->key != id) {
+                    curr.node = id < node->key ? node->lhs : node->rhs;
+                    __builtin_prefetch(curr.node);
+                    i++;
+                    continue;
+                }
+                out[curr.at] = node == nullptr ? nullptr : node->data;
+                if(next < count) { // reuse the slot
+                    curr.node = this->root;
+                    curr.at = next++;
+                    i++;
+                }
+                else { // shrink the window
+                    curr = window[--active];
+                }
+            }
+        }
+    }
+    std::vector<document*> find_batch(const std::vector<uint64_t>& ids)
+    {
+        std::vector<document*> ret_vec(ids.size());
+        this->find_batch(ids.data(), ids.size(), ret_vec.data());
+        return ret_vec;
+    }
+
+    /* visits every document in ascending id order */
+    template <typename F> void for_each(F visit)
+    {
+        this->for_each(this->root, visit);
+    }
 private:
+    // descents in flight in find_batch, enough to cover a memory stall
+    static constexpr uint32_t batch_window = 16;
+
     avl_node* root;
 
+    template <typename F> void for_each(avl_node* node, F& visit)
+    {
+        if(node == nullptr) { return; }
+        this->for_each(node->lhs, visit);
+        visit(node->data);
+        this->for_each(node->rhs, visit);
+    }
+
     void clear(avl_node* node)
     {
         if(node == nullptr) { return; }
@@ -95,6 +318,7 @@ private:
      */
     avl_node* rotate_left(avl_node* x)
     {
+        KS_COUNT(KS_AVL_ROTATIONS, 1);
         // create tmp node pointers
         avl_node* y = x->rhs;
         avl_node* y_lhs = y->lhs;
@@ -122,6 +346,7 @@ private:
      */
     avl_node* rotate_right(avl_node* y)
     {
+        KS_COUNT(KS_AVL_ROTATIONS, 1);
         // create tmp node pointers
         avl_node* x = y->lhs;
         avl_node* x_rhs = x->rhs;
@@ -188,13 +413,11 @@ private:
         if(node == nullptr) { return new avl_node(doc); }
 
         // recursive cases
-        if(doc->id < node->data->id) {
-            node->lhs = this->insert(node->lhs, doc);
-        }
-        else if(doc->id > node->data->id) {
+        if(doc->id < node->key) { node->lhs = this->insert(node->lhs, doc); }
+        else if(doc->id > node->key) {
             node->rhs = this->insert(node->rhs, doc);
         }
-        else { // doc-> id == node->data->id
+        else { // doc->id == node->key
             throw std::logic_error("ERR: A DOCUMENT WITH THE SAME ID EXISTS.");
         }
 
@@ -211,11 +434,11 @@ private:
     document* find(avl_node* node, uint64_t id)
     {
         if(node != nullptr) {
-            if(id < node->data->id) {
+            if(id < node->key) {
                 // id is to the left of curr
                 return this->find(node->lhs, id);
             }
-            else if(id > node->data->id) {
+            else if(id > node->key) {
                 return this->find(node->rhs, id);
             }
             else {
@@ -231,10 +454,8 @@ private:
     avl_node* remove(avl_node* node, uint64_t id, document*& doc)
     {
         // recursive cases
-        if(id < node->data->id) {
-            node->lhs = this->remove(node->lhs, id, doc);
-        }
-        else if(id > node->data->id) {
+        if(id < node->key) { node->lhs = this->remove(node->lhs, id, doc); }
+        else if(id > node->key) {
             node->rhs = this->remove(node->rhs, id, doc);
         }
         else { // found
@@ -261,9 +482,10 @@ private:
             // two child case
             else {
                 avl_node* min = this->find_min(node);
+                node->key = min->key;
                 node->data = min->data;
                 document* t_doc;
-                node->rhs = this->remove(node->rhs, min->data->id, t_doc);
+                node->rhs = this->remove(node->rhs, min->key, t_doc);
             }
         }
 
@@ -285,8 +507,8 @@ private:
 };
 
 class hash_table {
-    // hash formula:
-    // h = (s[0]*(53)^0 + s[1]*(53)^1 + ...) (mod 1009)
+    // keys are interned tag symbols, which are already dense, so:
+    // h = symbol (mod 1009)
 public:
     hash_table()
     {
@@ -306,58 +528,82 @@ public:
         }
     }
 
-    void insert(std::string tag, document* doc)
+    void insert(const std::string& tag, document* doc)
+    {
+        this->insert(tag_interner::global().intern(tag), doc);
+    }
+    void insert(uint32_t symbol, document* doc)
     {
-        uint64_t index = this->hash(tag);
+        KS_TIME(KS_HASH_INSERT);
+        uint64_t index = this->hash(symbol);
         hash_node* new_node = new hash_node();
-        new_node->tag = tag;
+        new_node->symbol = symbol;
         new_node->doc = doc;
         new_node->next = this->table[index];
         this->table[index] = new_node;
     }
-    std::vector<document*> search(std::string tag)
+    std::vector<document*> search(const std::string& tag)
     {
-        uint64_t index = this->hash(tag);
+        uint32_t symbol;
+        // a tag that was never interned cannot be in the table
+        if(!tag_interner::global().lookup(tag, symbol)) { return {}; }
+        return this->search(symbol);
+    }
+    std::vector<document*> search(uint32_t symbol)
+    {
+        KS_TIME(KS_HASH_SEARCH);
+        uint64_t index = this->hash(symbol);
 
         std::vector<document*> ret_vec;
         hash_node* curr = this->table[index];
 
+        uint64_t steps = 0;
         while(curr != nullptr) {
-            if(curr->tag == tag) { ret_vec.push_back(curr->doc); }
+            if(curr->symbol == symbol) { ret_vec.push_back(curr->doc); }
             curr = curr->next;
+            steps++;
         }
+        KS_COUNT(KS_HASH_CHAIN_STEPS, steps);
         return ret_vec;
     }
+
+    /* drops every entry that links symbol to doc */
+    void remove(uint32_t symbol, document* doc)
+    {
+        KS_TIME(KS_HASH_REMOVE);
+        hash_node** link = &this->table[this->hash(symbol)];
+        while(*link != nullptr) {
+            hash_node* curr = *link;
+            if(curr->symbol == symbol && curr->doc == doc) {
+                *link = curr->next;
+                delete curr;
+            }
+            else {
+                link = &curr->next;
+            }
+        }
+    }
+
+    /* visits every (symbol, document) pair stored in the table */
+    template <typename F> void for_each(F visit)
+    {
+        for(uint64_t i = 0; i < 1009; i++) {
+            for(hash_node* curr = this->table[i]; curr != nullptr;
+                curr = curr->next) {
+                visit(curr->symbol, curr->doc);
+            }
+        }
+    }
 private:
     struct hash_node {
-        std::string tag;
+        uint32_t symbol;
         document* doc;
         hash_node* next;
     };
 
     hash_node* table[1009];
 
-    uint64_t hash(std::string tag)
-    {
-        uint64_t hash = 0;
-        uint64_t i = 0;
-        uint64_t p = 1;
-        while(i < tag.length()) {
-            // get ascii value
-            uint64_t char_val = tag[i];
-            // normalize the number
-            char_val %= 1009;
-
-            // calculate the current hash value
-            hash += (char_val * p) % 1009;
-
-            // because first char should be multiplied with 1, not 53
-            p = (p * 53) % 1009;
-
-            i++;
-        }
-        return hash % 1009;
-    }
+    uint64_t hash(uint32_t symbol) { return symbol % 1009; }
 };
 
 class priority_queue {
@@ -367,16 +613,24 @@ class priority_queue {
     // right child of an index i : (2 * i) + 2
 private:
     std::vector<document*> heap;
+    std::unordered_map<document*, uint64_t> slots; // doc -> index in heap
 
+    void swap_slots(uint64_t a, uint64_t b)
+    {
+        KS_COUNT(KS_HEAP_SWAPS, 1);
+        document* tmp = this->heap[a];
+        this->heap[a] = this->heap[b];
+        this->heap[b] = tmp;
+        this->slots[this->heap[a]] = a;
+        this->slots[this->heap[b]] = b;
+    }
     void heapify_up(uint64_t doc_ind)
     {
         if(doc_ind == 0) { return; }
 
         uint64_t parent_ind = (doc_ind - 1) / 2;
         if(this->heap[doc_ind]->priority < this->heap[parent_ind]->priority) {
-            document* tmp = this->heap[doc_ind];
-            this->heap[doc_ind] = this->heap[parent_ind];
-            this->heap[parent_ind] = tmp;
+            this->swap_slots(doc_ind, parent_ind);
             this->heapify_up(parent_ind);
         }
     }
@@ -398,33 +652,64 @@ private:
             smallest = rhs;
         }
         if(smallest != doc_ind) {
-            // swap
-            document* tmp = this->heap[doc_ind];
-            this->heap[doc_ind] = this->heap[smallest];
-            this->heap[smallest] = tmp;
-
+            this->swap_slots(doc_ind, smallest);
             this->heapify_down(smallest);
         }
     }
+    /* fills slot doc_ind with the last task, false if doc_ind was last */
+    bool move_last_to(uint64_t doc_ind)
+    {
+        this->heap[doc_ind] = this->heap.back();
+        this->heap.pop_back();
+        if(doc_ind == this->heap.size()) { return false; }
+        this->slots[this->heap[doc_ind]] = doc_ind;
+        return true;
+    }
 public:
     document* get_next_task()
     {
+        KS_TIME(KS_PQ_NEXT);
         if(this->heap.empty()) { return nullptr; }
 
-        // swap first with last
         document* tmp = this->heap[0];
-        this->heap[0] = this->heap.back();
-        this->heap.pop_back();
-
-        if(!this->heap.empty()) { this->heapify_down(0); }
+        this->slots.erase(tmp);
+        if(this->move_last_to(0)) { this->heapify_down(0); }
 
         return tmp;
     }
+    /* a document can be queued once at a time */
     void add_new_task(document* doc)
     {
+        KS_TIME(KS_PQ_ADD);
+        if(!this->slots.emplace(doc, this->heap.size()).second) {
+            throw std::logic_error("ERR: DOCUMENT IS ALREADY QUEUED.");
+        }
         this->heap.push_back(doc);
         this->heapify_up(this->heap.size() - 1);
     }
+
+    /* takes doc out of the queue wherever it sits */
+    bool remove(document* doc)
+    {
+        KS_TIME(KS_PQ_REMOVE);
+        auto found = this->slots.find(doc);
+        if(found == this->slots.end()) { return false; }
+        uint64_t doc_ind = found->second;
+        this->slots.erase(found);
+
+        // move the last task into the hole and let it float either way
+        if(this->move_last_to(doc_ind)) {
+            this->heapify_up(doc_ind);
+            this->heapify_down(doc_ind);
+        }
+        return true;
+    }
+
+    /* visits the queued documents in heap (array) order */
+    template <typename F> void for_each(F visit)
+    {
+        for(document* doc : this->heap) { visit(doc); }
+    }
 };
 
 class visited_node_set { // small helper class for knowledge graph
@@ -480,13 +765,140 @@ class knowledge_graph {
 public:
     knowledge_graph()
     {
-        for(uint64_t i = 0; i < 1009; i++) { this->node_table[i] = nullptr; }
+        for(uint64_t i = 0; i < 1009; i++) {
+            this->node_table[i] = nullptr;
+            this->back_table[i] = nullptr;
+        }
     } // knowledge graph constructor
 
     ~knowledge_graph()
+    {
+        this->clear(this->node_table);
+        this->clear(this->back_table);
+    }
+
+    void add_reference(uint64_t from_id, uint64_t to_id)
+    {
+        KS_TIME(KS_GRAPH_ADD_REF);
+        // append to_id to the list of documents that from_id references
+        this->link(this->node_table, from_id, to_id);
+        // and remember from_id as one of the documents that reference to_id
+        this->link(this->back_table, to_id, from_id);
+    }
+
+    /*
+     * the two halves of add_reference. the forward edge lives in from_id's
+     * bucket of node_table, the reverse edge in to_id's bucket of
+     * back_table, and threads that only link into disjoint bucket ranges
+     * never touch the same chain, so they can link at the same time.
+     */
+    void add_forward(uint64_t from_id, uint64_t to_id)
+    {
+        this->link(this->node_table, from_id, to_id);
+    }
+    void add_backward(uint64_t from_id, uint64_t to_id)
+    {
+        this->link(this->back_table, to_id, from_id);
+    }
+    uint64_t bucket_of(uint64_t id) { return this->hash(id); }
+    uint64_t bucket_count() { return 1009; }
+
+    /* drops every edge that starts or ends at id, in both tables */
+    void remove_document(uint64_t id)
+    {
+        KS_TIME(KS_GRAPH_REMOVE);
+        for(uint64_t to_id : this->detach(this->node_table, id)) {
+            this->unlink(this->back_table, to_id, id);
+        }
+        for(uint64_t from_id : this->detach(this->back_table, id)) {
+            this->unlink(this->node_table, from_id, id);
+        }
+    }
+
+    /* ids of the documents that reference id, i.e. the reverse edges */
+    std::vector<uint64_t> get_backlinks(uint64_t id)
+    {
+        KS_TIME(KS_GRAPH_BACKLINKS);
+        std::vector<uint64_t> ret_vec;
+        graph_node* node = this->locate(this->back_table, id);
+        if(node != nullptr) {
+            ref* curr_ref = node->refs;
+            while(curr_ref != nullptr) {
+                ret_vec.push_back(curr_ref->to_id);
+                curr_ref = curr_ref->next;
+            }
+        }
+        return ret_vec;
+    }
+
+    /* visits every forward edge as (from_id, to_id) */
+    template <typename F> void for_each_reference(F visit)
     {
         for(uint64_t i = 0; i < 1009; i++) {
-            graph_node* curr_node = this->node_table[i];
+            for(graph_node* node = this->node_table[i]; node != nullptr;
+                node = node->next) {
+                for(ref* curr_ref = node->refs; curr_ref != nullptr;
+                    curr_ref = curr_ref->next) {
+                    visit(node->from_id, curr_ref->to_id);
+                }
+            }
+        }
+    }
+
+    /*
+     * bidirectional bfs: one frontier grows forward from the source over
+     * node_table, the other grows backward from the target over back_table.
+     * every round expands whichever frontier is smaller, and the search stops
+     * as soon as one side discovers a node the other side has already seen.
+     */
+    bool is_reachable(uint64_t source_id, uint64_t target_id)
+    {
+        KS_TIME(KS_GRAPH_REACHABLE);
+        if(source_id == target_id) { return true; }
+
+        visited_node_set fwd_visited;
+        visited_node_set bwd_visited;
+        std::vector<uint64_t> fwd_frontier(1, source_id);
+        std::vector<uint64_t> bwd_frontier(1, target_id);
+        fwd_visited.mark(source_id);
+        bwd_visited.mark(target_id);
+
+        while(!fwd_frontier.empty() && !bwd_frontier.empty()) {
+            bool met;
+            if(fwd_frontier.size() <= bwd_frontier.size()) {
+                met = this->expand(this->node_table, fwd_frontier,
+                                   fwd_visited, bwd_visited);
+            }
+            else {
+                met = this->expand(this->back_table, bwd_frontier,
+                                   bwd_visited, fwd_visited);
+            }
+            if(met) { return true; }
+        }
+        return false;
+    }
+private:
+    /* a linked list of the references made in a document */
+    struct ref {
+        uint64_t to_id; // id of the document on the other end of the edge
+        ref* next; // next reference in made in this document
+    };
+
+    /* a linked list of the graph nodes */
+    struct graph_node {
+        uint64_t from_id; // id of the document
+        ref* refs; // references made from this node
+        graph_node* next; // next node in the graph
+    };
+
+    graph_node* node_table[1009]; // forward edges, from_id -> to_id
+    graph_node* back_table[1009]; // reverse edges, to_id -> from_id
+    uint64_t hash(uint64_t id) { return (id * 2654435761) % 1009; }
+
+    void clear(graph_node** table)
+    {
+        for(uint64_t i = 0; i < 1009; i++) {
+            graph_node* curr_node = table[i];
             while(curr_node != nullptr) {
                 ref* curr_ref = curr_node->refs;
                 /* delete all refs for this node */
@@ -504,80 +916,105 @@ public:
         }
     }
 
-    void add_reference(uint64_t from_id, uint64_t to_id)
+    graph_node* locate(graph_node** table, uint64_t id)
     {
-        uint64_t from_index = this->hash(from_id);
-
-        graph_node* node = this->node_table[from_index];
-        while(node != nullptr) {
-            if(node->from_id == from_id) { break; }
-            else {
-                node = node->next;
-            }
+        graph_node* node = table[this->hash(id)];
+        uint64_t steps = 0;
+        while(node != nullptr && node->from_id != id) {
+            node = node->next;
+            steps++;
         }
+        KS_COUNT(KS_GRAPH_CHAIN_STEPS, steps);
+        return node;
+    }
+
+    void link(graph_node** table, uint64_t from_id, uint64_t to_id)
+    {
+        graph_node* node = this->locate(table, from_id);
         if(node == nullptr) { // no refs
-            graph_node* new_node = new graph_node();
-            node = new_node;
+            uint64_t from_index = this->hash(from_id);
+            node = new graph_node();
             node->from_id = from_id;
             node->refs = nullptr;
 
-            node->next = this->node_table[from_index];
-            this->node_table[from_index] = node;
+            node->next = table[from_index];
+            table[from_index] = node;
         }
         ref* new_ref = new ref();
         new_ref->to_id = to_id;
         new_ref->next = node->refs;
         node->refs = new_ref;
-
-        // locate node from_id
-        // append to_id to the list of documents that from_id references
     }
 
-    bool is_reachable(uint64_t source_id, uint64_t target_id)
+    /* removes id's node from table and returns where its edges pointed */
+    std::vector<uint64_t> detach(graph_node** table, uint64_t id)
     {
-        visited_node_set visited;
-
-        return dfs_recursive(source_id, target_id, visited);
+        std::vector<uint64_t> ret_vec;
+        graph_node** link = &table[this->hash(id)];
+        while(*link != nullptr && (*link)->from_id != id) {
+            link = &(*link)->next;
+        }
+        if(*link == nullptr) { return ret_vec; }
+
+        graph_node* node = *link;
+        *link = node->next;
+        ref* curr_ref = node->refs;
+        while(curr_ref != nullptr) {
+            ret_vec.push_back(curr_ref->to_id);
+            ref* tmp_ref = curr_ref;
+            curr_ref = curr_ref->next;
+            delete tmp_ref;
+        }
+        delete node;
+        return ret_vec;
     }
-private:
-    /* a linked list of the references made in a document */
-    struct ref {
-        uint64_t to_id; // id of the document this document references to
-        ref* next; // next reference in made in this document
-    };
-
-    /* a linked list of the graph nodes */
-    struct graph_node {
-        uint64_t from_id; // id of the document
-        ref* refs; // references made from this node
-        graph_node* next; // next node in the graph
-    };
-
-    graph_node* node_table[1009];
-    uint64_t hash(uint64_t id) { return (id * 2654435761) % 1009; }
 
-    bool dfs_recursive(uint64_t current_id, uint64_t target_id,
-                       visited_node_set& visited_nodes)
+    /* removes every from_id -> to_id edge from table */
+    void unlink(graph_node** table, uint64_t from_id, uint64_t to_id)
     {
-        if(current_id == target_id) { return true; }
-        if(visited_nodes.has(current_id)) { return false; }
-        visited_nodes.mark(current_id);
-
-        uint64_t index = this->hash(current_id);
-        graph_node* node = this->node_table[index];
-        while(node != nullptr && node->from_id != current_id) {
-            node = node->next;
+        graph_node* node = this->locate(table, from_id);
+        if(node == nullptr) { return; }
+        ref** link = &node->refs;
+        while(*link != nullptr) {
+            ref* curr_ref = *link;
+            if(curr_ref->to_id == to_id) {
+                *link = curr_ref->next;
+                delete curr_ref;
+            }
+            else {
+                link = &curr_ref->next;
+            }
         }
+    }
+
+    /*
+     * replaces frontier with the unvisited neighbours of its nodes in table.
+     * returns true once a neighbour has already been seen by the other side.
+     */
+    bool expand(graph_node** table, std::vector<uint64_t>& frontier,
+                visited_node_set& own_visited,
+                visited_node_set& other_visited)
+    {
+        std::vector<uint64_t> next_frontier;
+        KS_COUNT(KS_GRAPH_NODES_VISITED, frontier.size());
+        for(uint64_t id : frontier) {
+            graph_node* node = this->locate(table, id);
+            if(node == nullptr) { continue; }
 
-        if(node != nullptr) {
             ref* curr_ref = node->refs;
             while(curr_ref != nullptr) {
-                if(dfs_recursive(curr_ref->to_id, target_id, visited_nodes)) {
-                    return true;
+                uint64_t next_id = curr_ref->to_id;
+                if(other_visited.has(next_id)) { return true; }
+                if(!own_visited.has(next_id)) {
+                    own_visited.mark(next_id);
+                    next_frontier.push_back(next_id);
                 }
                 curr_ref = curr_ref->next;
             }
         }
+        frontier.swap(next_frontier);
         return false;
     }
 };
+
+#endif // SYS_H
@@ -0,0 +1,280 @@
+#ifndef TAG_INDEX_H
+#define TAG_INDEX_H
+
+#include "sys.h"
+#include <memory>
+
+/*
+ * tag symbol -> documents index that many threads can write at once.
+ *
+ * symbols are striped over a power of two number of shards, each with its
+ * own lock and its own posting lists, and each on its own cache lines.
+ * symbols are dense, so symbol s lives in shard s & mask at slot
+ * s >> shard_bits and finding its postings takes two array indexings.
+ *
+ * every operation locks one shard only, so writers on different shards
+ * never wait for each other and a reader only ever waits on the shard it
+ * reads. the lock is a plain mutex: reads hold it just long enough to copy
+ * one posting list, and an uncontended std::shared_mutex costs about four
+ * times as much as a std::mutex on the insert path.
+ *
+ * a posting list is a chain of fixed size chunks carved out of its shard's
+ * arena, not a growing vector: appending never copies the list or calls
+ * malloc, and chunks a removal empties go on the shard's free list.
+ *
+ * inserts do not touch the posting lists at all. they are appended to the
+ * shard's pending buffer, which is applied in one go when it fills or
+ * before anything reads the shard. applying a buffer prefetches the list
+ * headers and tails a few entries ahead, so the cache misses of many
+ * inserts overlap instead of each insert stalling on two of its own.
+ */
+class tag_index {
+public:
+    tag_index(uint32_t shard_count = 64)
+        : shard_bits(log2_up(std::max(1u, shard_count))),
+          mask((1u << this->shard_bits) - 1), shards(this->mask + 1)
+    {} // tag index constructor
+
+    tag_index(const tag_index&) = delete;
+    tag_index& operator=(const tag_index&) = delete;
+
+    void insert(const std::string& tag, document* doc)
+    {
+        this->insert(tag_interner::global().intern(tag), doc);
+    }
+    void insert(uint32_t symbol, document* doc)
+    {
+        KS_TIME(KS_TAGS_INSERT);
+        shard& owner = this->shard_of(symbol);
+        std::unique_lock<std::mutex> guard(owner.lock, std::defer_lock);
+        lock_counted(guard);
+        uint32_t slot = symbol >> this->shard_bits;
+        owner.pending.push_back(std::make_pair(slot, doc));
+        if(owner.pending.size() >= pending_limit) { owner.apply_pending(); }
+    }
+    /* every tag of doc, one shard lock per tag */
+    void insert(document* doc)
+    {
+        for(uint32_t symbol : doc->tags) { this->insert(symbol, doc); }
+    }
+
+    std::vector<document*> search(const std::string& tag)
+    {
+        uint32_t symbol;
+        // a tag that was never interned cannot be in the index
+        if(!tag_interner::global().lookup(tag, symbol)) { return {}; }
+        return this->search(symbol);
+    }
+    std::vector<document*> search(uint32_t symbol)
+    {
+        KS_TIME(KS_TAGS_SEARCH);
+        shard& owner = this->shard_of(symbol);
+        std::lock_guard<std::mutex> guard(owner.lock);
+        owner.apply_pending();
+        uint32_t slot = symbol >> this->shard_bits;
+        std::vector<document*> ret_vec;
+        if(slot >= owner.postings.size()) { return ret_vec; }
+        const posting_list& list = owner.postings[slot];
+        ret_vec.reserve(list.count);
+        list.for_each([&](document* doc) { ret_vec.push_back(doc); });
+        return ret_vec;
+    }
+    uint64_t count(uint32_t symbol)
+    {
+        shard& owner = this->shard_of(symbol);
+        std::lock_guard<std::mutex> guard(owner.lock);
+        owner.apply_pending();
+        uint32_t slot = symbol >> this->shard_bits;
+        return slot < owner.postings.size() ? owner.postings[slot].count : 0;
+    }
+
+    /* drops every entry that links symbol to doc */
+    void remove(uint32_t symbol, document* doc)
+    {
+        KS_TIME(KS_TAGS_REMOVE);
+        shard& owner = this->shard_of(symbol);
+        std::unique_lock<std::mutex> guard(owner.lock, std::defer_lock);
+        lock_counted(guard);
+        owner.apply_pending();
+        uint32_t slot = symbol >> this->shard_bits;
+        if(slot >= owner.postings.size()) { return; }
+        posting_list& list = owner.postings[slot];
+
+        // slide the survivors down in place, keeping insertion order
+        chunk* write = list.head;
+        uint32_t kept = 0;
+        list.for_each([&](document* curr) {
+            if(curr == doc) { return; }
+            if(kept > 0 && kept % chunk_docs == 0) { write = write->next; }
+            write->docs[kept % chunk_docs] = curr;
+            kept++;
+        });
+        if(kept == list.count) { return; }
+
+        chunk* spare = kept == 0 ? list.head : write->next;
+        list.tail = kept == 0 ? nullptr : write;
+        if(kept == 0) { list.head = nullptr; }
+        else { write->next = nullptr; }
+        list.count = kept;
+        while(spare != nullptr) {
+            chunk* next = spare->next;
+            owner.free_chunk(spare);
+            spare = next;
+        }
+    }
+
+    /*
+     * visits every (symbol, document) pair, one shard at a time. visit must
+     * not call back into the index.
+     */
+    template <typename F> void for_each(F visit)
+    {
+        for(uint32_t s = 0; s <= this->mask; s++) {
+            shard& curr = this->shards[s];
+            std::lock_guard<std::mutex> guard(curr.lock);
+            curr.apply_pending();
+            for(uint32_t slot = 0; slot < curr.postings.size(); slot++) {
+                uint32_t symbol = (slot << this->shard_bits) | s;
+                curr.postings[slot].for_each(
+                    [&](document* doc) { visit(symbol, doc); });
+            }
+        }
+    }
+
+    uint32_t shard_count() { return this->mask + 1; }
+    /*
+     * the shard symbol lives in. writers that split their inserts by shard
+     * never share a shard lock, so none of them waits on another.
+     */
+    uint32_t shard_index(uint32_t symbol) { return symbol & this->mask; }
+private:
+    // two cache lines per chunk, the next pointer included
+    static constexpr uint32_t chunk_docs = 15;
+    static constexpr uint32_t arena_chunks = 256; // chunks per arena block
+    static constexpr uint32_t pending_limit = 512; // inserts per shard
+    static constexpr uint32_t prefetch_ahead = 16; // pending entries
+
+    struct chunk {
+        document* docs[chunk_docs];
+        chunk* next;
+    };
+
+    struct posting_list {
+        chunk* head = nullptr;
+        chunk* tail = nullptr; // holds docs count - 1, if any
+        uint64_t count = 0;
+
+        template <typename F> void for_each(F visit) const
+        {
+            uint64_t left = this->count;
+            for(chunk* curr = this->head; left > 0; curr = curr->next) {
+                uint64_t used = std::min<uint64_t>(left, chunk_docs);
+                for(uint64_t i = 0; i < used; i++) { visit(curr->docs[i]); }
+                left -= used;
+            }
+        }
+    };
+
+    struct alignas(64) shard {
+        std::mutex lock;
+        std::vector<posting_list> postings; // by slot
+        std::vector<std::unique_ptr<chunk[]>> arena;
+        uint32_t arena_used = arena_chunks; // of the last arena block
+        chunk* free_chunks = nullptr;
+        std::vector<std::pair<uint32_t, document*>> pending; // slot, doc
+
+        void apply_pending()
+        {
+            uint64_t n = this->pending.size();
+            if(n == 0) { return; }
+            uint32_t top = 0;
+            for(const std::pair<uint32_t, document*>& entry : this->pending) {
+                top = std::max(top, entry.first);
+            }
+            if(top >= this->postings.size()) { this->postings.resize(top + 1); }
+
+            // headers two strides ahead, the tails they point at one stride
+            // ahead, by which time those headers have arrived
+            for(uint64_t i = 0; i < n; i++) {
+                if(i + 2 * prefetch_ahead < n) {
+                    __builtin_prefetch(
+                        &this->postings[this->pending[i + 2 * prefetch_ahead]
+                                            .first]);
+                }
+                if(i + prefetch_ahead < n) {
+                    const posting_list& ahead =
+                        this->postings[this->pending[i + prefetch_ahead].first];
+                    if(ahead.tail != nullptr) {
+                        __builtin_prefetch(
+                            ahead.tail->docs + ahead.count % chunk_docs, 1);
+                    }
+                }
+                this->append(this->postings[this->pending[i].first],
+                             this->pending[i].second);
+            }
+            this->pending.clear();
+        }
+
+        void append(posting_list& list, document* doc)
+        {
+            uint32_t at = list.count % chunk_docs;
+            if(at == 0) {
+                chunk* fresh = this->new_chunk();
+                if(list.tail == nullptr) { list.head = fresh; }
+                else { list.tail->next = fresh; }
+                list.tail = fresh;
+            }
+            list.tail->docs[at] = doc;
+            list.count++;
+        }
+
+        chunk* new_chunk()
+        {
+            chunk* fresh;
+            if(this->free_chunks != nullptr) {
+                fresh = this->free_chunks;
+                this->free_chunks = fresh->next;
+            }
+            else {
+                if(this->arena_used == arena_chunks) {
+                    this->arena.emplace_back(new chunk[arena_chunks]);
+                    this->arena_used = 0;
+                }
+                fresh = &this->arena.back()[this->arena_used++];
+            }
+            fresh->next = nullptr;
+            return fresh;
+        }
+        void free_chunk(chunk* old)
+        {
+            old->next = this->free_chunks;
+            this->free_chunks = old;
+        }
+    };
+
+    uint32_t shard_bits;
+    uint32_t mask;
+    std::vector<shard> shards;
+
+    shard& shard_of(uint32_t symbol)
+    {
+        return this->shards[symbol & this->mask];
+    }
+
+    /* takes the lock and counts it when another thread held it first */
+    static void lock_counted(std::unique_lock<std::mutex>& guard)
+    {
+        if(guard.try_lock()) { return; }
+        KS_COUNT(KS_TAG_CONTENDED_LOCKS, 1);
+        guard.lock();
+    }
+
+    static uint32_t log2_up(uint32_t n)
+    {
+        uint32_t bits = 0;
+        while((1u << bits) < n) { bits++; }
+        return bits;
+    }
+};
+
+#endif // TAG_INDEX_H
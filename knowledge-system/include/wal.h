@@ -0,0 +1,512 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include "content_store.h"
+#include "sys.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * append-only redo log. every record is framed as
+ *
+ * | uint32_t payload length | uint32_t crc32(op + payload) | op | payload |
+ *
+ * callers log an operation after applying it to the in-memory structures,
+ * recovery replays the longest prefix of intact records and cuts off the
+ * torn tail a crash may have left behind.
+ */
+
+enum class wal_sync {
+    none, // hand batches to the os, never fsync
+    group, // fsync every batch, commit() waits for durability
+    always // every log call waits until its own record is fsynced
+};
+
+enum wal_op : uint8_t {
+    WAL_INSERT_DOC = 1, // avl_tree::insert, carries the whole document
+    WAL_REMOVE_DOC, // avl_tree::remove
+    WAL_ADD_TAG, // hash_table::insert
+    WAL_ADD_REF, // knowledge_graph::add_reference
+    WAL_PUSH_TASK, // priority_queue::add_new_task
+    WAL_POP_TASK // priority_queue::get_next_task
+};
+
+inline uint32_t wal_crc32(const uint8_t* data, uint64_t length)
+{
+    // built once, recovery calls this from several threads
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> ret;
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            ret[i] = c;
+        }
+        return ret;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for(uint64_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+class wal_writer {
+public:
+    /*
+     * group_bytes and group_interval bound how long a record may sit in the
+     * pending buffer before the flusher thread writes the batch out.
+     */
+    wal_writer(const std::string& path, wal_sync policy = wal_sync::group,
+               uint64_t group_bytes = 1 << 20,
+               std::chrono::microseconds group_interval =
+                   std::chrono::microseconds(2000))
+        : policy(policy), group_bytes(group_bytes),
+          group_interval(group_interval), waiters(0), stopping(false),
+          failed(false)
+    {
+        this->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(this->fd < 0) { throw std::runtime_error("ERR: CANNOT OPEN WAL."); }
+        this->appended_lsn = lseek(this->fd, 0, SEEK_END);
+        this->durable_lsn = this->appended_lsn;
+        this->flusher = std::thread([this] { this->flush_loop(); });
+    } // wal writer constructor
+
+    ~wal_writer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->wake.notify_one();
+        this->flusher.join();
+        close(this->fd);
+    } // flushes whatever is still pending
+
+    wal_writer(const wal_writer&) = delete;
+    wal_writer& operator=(const wal_writer&) = delete;
+
+    /*
+     * every log call returns the lsn (end offset in the log) of its record.
+     * contents is where doc keeps its body if it was compacted.
+     */
+    uint64_t log_insert(document* doc, content_store* contents = nullptr)
+    {
+        std::string payload;
+        put(payload, doc->id);
+        put(payload, doc->priority);
+        put_string(payload, document_body(doc, contents));
+        put(payload, doc->tags.size());
+        for(uint32_t i = 0; i < doc->tags.size(); i++) {
+            put_string(payload, doc->tag_name(i));
+        }
+        put(payload, doc->refs.size());
+        for(uint64_t ref : doc->refs) { put(payload, ref); }
+        return this->append(WAL_INSERT_DOC, payload);
+    }
+    uint64_t log_remove(uint64_t id)
+    {
+        std::string payload;
+        put(payload, id);
+        return this->append(WAL_REMOVE_DOC, payload);
+    }
+    uint64_t log_tag(const std::string& tag, uint64_t id)
+    {
+        std::string payload;
+        put(payload, id);
+        put_string(payload, tag);
+        return this->append(WAL_ADD_TAG, payload);
+    }
+    uint64_t log_reference(uint64_t from_id, uint64_t to_id)
+    {
+        std::string payload;
+        put(payload, from_id);
+        put(payload, to_id);
+        return this->append(WAL_ADD_REF, payload);
+    }
+    uint64_t log_push(uint64_t id)
+    {
+        std::string payload;
+        put(payload, id);
+        return this->append(WAL_PUSH_TASK, payload);
+    }
+    uint64_t log_pop() { return this->append(WAL_POP_TASK, std::string()); }
+
+    /*
+     * blocks until every record logged so far has been written out. once a
+     * write or sync has failed, this and every later call throws.
+     */
+    void commit()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->wait_durable(guard, this->appended_lsn);
+    }
+private:
+    int fd;
+    wal_sync policy;
+    uint64_t group_bytes;
+    std::chrono::microseconds group_interval;
+
+    std::mutex lock;
+    std::condition_variable wake; // wakes the flusher
+    std::condition_variable flushed; // wakes threads waiting on durability
+    std::string pending;
+    uint64_t appended_lsn;
+    uint64_t durable_lsn;
+    uint64_t waiters;
+    bool stopping;
+    bool failed; // sticky, set by the flusher when a write or sync fails
+    std::thread flusher;
+
+    template <typename T> static void put(std::string& out, T value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    static void put_string(std::string& out, const std::string& value)
+    {
+        put(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    uint64_t append(wal_op op, const std::string& payload)
+    {
+        std::string body(1, static_cast<char>(op));
+        body.append(payload);
+
+        std::string record;
+        put(record, static_cast<uint32_t>(payload.size()));
+        put(record, wal_crc32(reinterpret_cast<const uint8_t*>(body.data()),
+                              body.size()));
+        record.append(body);
+
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->check_failed();
+        this->pending.append(record);
+        this->appended_lsn += record.size();
+        uint64_t lsn = this->appended_lsn;
+
+        if(this->policy == wal_sync::always) {
+            this->wait_durable(guard, lsn);
+        }
+        else if(this->pending.size() >= this->group_bytes) {
+            this->wake.notify_one();
+        }
+        return lsn;
+    }
+
+    void wait_durable(std::unique_lock<std::mutex>& guard, uint64_t lsn)
+    {
+        this->waiters++;
+        this->wake.notify_one();
+        this->flushed.wait(guard, [&] {
+            return this->durable_lsn >= lsn || this->failed;
+        });
+        this->waiters--;
+        if(this->durable_lsn < lsn) { this->check_failed(); }
+    }
+
+    void check_failed()
+    {
+        if(this->failed) { throw std::runtime_error("ERR: WAL WRITE FAILED."); }
+    }
+
+    /*
+     * group commit: while one batch is being written and synced, new records
+     * pile up in pending and go out together in the next batch, so a single
+     * fsync covers every thread that was waiting on it.
+     */
+    void flush_loop()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while(true) {
+            this->wake.wait_for(guard, this->group_interval, [&] {
+                return this->stopping
+                       || (!this->pending.empty()
+                           && (this->waiters > 0
+                               || this->pending.size() >= this->group_bytes));
+            });
+            if(this->pending.empty() || this->failed) {
+                if(this->stopping) { return; }
+                continue;
+            }
+
+            std::string batch;
+            batch.swap(this->pending);
+            uint64_t batch_lsn = this->appended_lsn;
+
+            guard.unlock();
+            bool ok = this->write_all(batch);
+            if(ok && this->policy != wal_sync::none) {
+                ok = fdatasync(this->fd) == 0;
+            }
+            guard.lock();
+
+            // after a failure the file may hold part of the batch, nothing
+            // past durable_lsn can be promised from here on
+            if(ok) { this->durable_lsn = batch_lsn; }
+            else {
+                this->failed = true;
+                this->pending.clear();
+            }
+            this->flushed.notify_all();
+        }
+    }
+
+    /* runs on the flusher thread, so it reports failure instead of throwing */
+    bool write_all(const std::string& batch)
+    {
+        const char* data = batch.data();
+        uint64_t left = batch.size();
+        while(left > 0) {
+            ssize_t done = ::write(this->fd, data, left);
+            if(done < 0) {
+                if(errno == EINTR) { continue; }
+                return false;
+            }
+            data += done;
+            left -= done;
+        }
+        return true;
+    }
+};
+
+class wal_reader {
+public:
+    /*
+     * replays path into the given (empty) structures and returns the
+     * documents it recreated, the caller owns them just like main's all_docs.
+     * a torn or corrupt tail is cut off the file so new appends start clean.
+     */
+    std::vector<document*> recover(const std::string& path, avl_tree& tree,
+                                   hash_table& tags, priority_queue& pq,
+                                   knowledge_graph& graph)
+    {
+        std::string log;
+        {
+            std::ifstream in(path, std::ios::binary);
+            if(!in) { return std::vector<document*>(); } // nothing logged yet
+            log.assign(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+        }
+
+        std::vector<record> records = this->frame(log);
+        uint64_t valid = this->verify(log, records);
+        if(valid < records.size()) {
+            uint64_t cut = records[valid].offset;
+            records.resize(valid);
+            if(truncate(path.c_str(), cut) != 0) {
+                throw std::runtime_error("ERR: CANNOT TRUNCATE WAL.");
+            }
+        }
+
+        std::vector<document*> docs = this->resolve(log, records);
+        this->apply(log, records, tree, tags, pq, graph);
+        return docs;
+    }
+private:
+    struct record {
+        uint64_t offset; // start of the frame
+        uint64_t length; // whole frame
+        wal_op op;
+        document* doc; // resolved during the sequential pass
+    };
+
+    struct cursor {
+        const char* data;
+
+        template <typename T> T get()
+        {
+            T value;
+            std::memcpy(&value, this->data, sizeof(value));
+            this->data += sizeof(value);
+            return value;
+        }
+        std::string get_string()
+        {
+            uint32_t length = this->get<uint32_t>();
+            std::string value(this->data, length);
+            this->data += length;
+            return value;
+        }
+    };
+
+    static constexpr uint64_t header_size = 2 * sizeof(uint32_t);
+
+    /* finds record boundaries, only the length fields are read */
+    std::vector<record> frame(const std::string& log)
+    {
+        std::vector<record> records;
+        uint64_t offset = 0;
+        while(offset + header_size + 1 <= log.size()) {
+            uint32_t payload_len;
+            std::memcpy(&payload_len, log.data() + offset, sizeof(payload_len));
+            uint64_t length = header_size + 1 + payload_len;
+            if(offset + length > log.size()) { break; } // torn tail
+
+            record rec;
+            rec.offset = offset;
+            rec.length = length;
+            rec.op = static_cast<wal_op>(log[offset + header_size]);
+            rec.doc = nullptr;
+            records.push_back(rec);
+            offset += length;
+        }
+        // a trailing partial frame still has to be cut off
+        if(offset < log.size()) {
+            record rec = {offset, log.size() - offset, WAL_POP_TASK, nullptr};
+            records.push_back(rec);
+        }
+        return records;
+    }
+
+    /* checks crcs on every core, returns the number of intact records */
+    uint64_t verify(const std::string& log, const std::vector<record>& records)
+    {
+        uint64_t workers = std::max(1u, std::thread::hardware_concurrency());
+        uint64_t chunk = (records.size() + workers - 1) / workers;
+        std::atomic<uint64_t> first_bad(records.size());
+
+        std::vector<std::thread> threads;
+        for(uint64_t w = 0; w < workers; w++) {
+            uint64_t begin = w * chunk;
+            uint64_t end = std::min<uint64_t>(begin + chunk, records.size());
+            if(begin >= end) { break; }
+            threads.emplace_back([&, begin, end] {
+                for(uint64_t i = begin; i < end; i++) {
+                    if(!this->intact(log, records[i])) {
+                        uint64_t seen = first_bad.load();
+                        while(i < seen
+                              && !first_bad.compare_exchange_weak(seen, i)) {}
+                        return;
+                    }
+                }
+            });
+        }
+        for(std::thread& thread : threads) { thread.join(); }
+        return first_bad.load();
+    }
+
+    bool intact(const std::string& log, const record& rec)
+    {
+        if(rec.length < header_size + 1) { return false; }
+        uint32_t payload_len;
+        uint32_t crc;
+        std::memcpy(&payload_len, log.data() + rec.offset, sizeof(payload_len));
+        std::memcpy(&crc, log.data() + rec.offset + sizeof(payload_len),
+                    sizeof(crc));
+        if(header_size + 1 + payload_len != rec.length) { return false; }
+        const uint8_t* body =
+            reinterpret_cast<const uint8_t*>(log.data() + rec.offset)
+            + header_size;
+        return wal_crc32(body, rec.length - header_size) == crc;
+    }
+
+    /*
+     * recreates the documents in log order and binds every record to the
+     * document its id named at that point, so the structures can be
+     * replayed independently afterwards.
+     */
+    std::vector<document*> resolve(const std::string& log,
+                                   std::vector<record>& records)
+    {
+        std::vector<document*> docs;
+        std::unordered_map<uint64_t, document*> by_id;
+        try {
+            for(record& rec : records) {
+                cursor in = {log.data() + rec.offset + header_size + 1};
+                if(rec.op == WAL_INSERT_DOC) {
+                    uint64_t id = in.get<uint64_t>();
+                    uint8_t priority = in.get<uint8_t>();
+                    document* doc = new document(id, in.get_string());
+                    docs.push_back(doc);
+                    doc->priority = priority;
+                    uint32_t tag_count = in.get<uint32_t>();
+                    for(uint32_t i = 0; i < tag_count; i++) {
+                        doc->add_tag(in.get_string());
+                    }
+                    uint32_t ref_count = in.get<uint32_t>();
+                    for(uint32_t i = 0; i < ref_count; i++) {
+                        doc->add_ref(in.get<uint64_t>());
+                    }
+                    by_id[id] = doc;
+                    rec.doc = doc;
+                }
+                else if(rec.op == WAL_ADD_TAG || rec.op == WAL_PUSH_TASK) {
+                    auto found = by_id.find(in.get<uint64_t>());
+                    if(found == by_id.end()) {
+                        throw std::logic_error(
+                            "ERR: WAL NAMES AN UNKNOWN DOCUMENT.");
+                    }
+                    rec.doc = found->second;
+                }
+            }
+        }
+        catch(...) {
+            // nothing was replayed yet, so nobody else holds these
+            for(document* doc : docs) { delete doc; }
+            throw;
+        }
+        return docs;
+    }
+
+    /* each structure is independent, so each gets its own replay thread */
+    void apply(const std::string& log, const std::vector<record>& records,
+               avl_tree& tree, hash_table& tags, priority_queue& pq,
+               knowledge_graph& graph)
+    {
+        auto payload = [&](const record& rec) {
+            return cursor{log.data() + rec.offset + header_size + 1};
+        };
+
+        std::exception_ptr tree_error;
+        std::thread tree_thread([&] {
+            try {
+                for(const record& rec : records) {
+                    if(rec.op == WAL_INSERT_DOC) { tree.insert(rec.doc); }
+                    else if(rec.op == WAL_REMOVE_DOC) {
+                        tree.remove(payload(rec).get<uint64_t>());
+                    }
+                }
+            }
+            catch(...) { // duplicate ids, rethrown on the calling thread
+                tree_error = std::current_exception();
+            }
+        });
+        std::thread tag_thread([&] {
+            for(const record& rec : records) {
+                if(rec.op != WAL_ADD_TAG) { continue; }
+                cursor in = payload(rec);
+                in.get<uint64_t>();
+                tags.insert(in.get_string(), rec.doc);
+            }
+        });
+        std::thread pq_thread([&] {
+            for(const record& rec : records) {
+                if(rec.op == WAL_PUSH_TASK) { pq.add_new_task(rec.doc); }
+                else if(rec.op == WAL_POP_TASK) { pq.get_next_task(); }
+            }
+        });
+        for(const record& rec : records) {
+            if(rec.op != WAL_ADD_REF) { continue; }
+            cursor in = payload(rec);
+            uint64_t from_id = in.get<uint64_t>();
+            graph.add_reference(from_id, in.get<uint64_t>());
+        }
+        tree_thread.join();
+        tag_thread.join();
+        pq_thread.join();
+        if(tree_error) { std::rethrow_exception(tree_error); }
+    }
+};
+
+#endif // WAL_H
@@ -0,0 +1,162 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "sys.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+
+/*
+ * a fixed set of threads that live as long as the pool, so callers that fan
+ * out many small rounds of work do not pay for a thread start (and its stats
+ * block) every round.
+ *
+ * work is handed out as jobs of numbered parts. start() queues a job and
+ * returns at once, wait() blocks until every part has finished and rethrows
+ * the first exception any part threw. a waiting thread runs queued parts
+ * itself instead of sleeping, so a pool of workers - 1 threads plus the
+ * caller keeps workers cores busy, and a pool of zero threads runs
+ * everything inside wait().
+ */
+class worker_pool {
+private:
+    struct job_state {
+        std::function<void(uint64_t)> work;
+        uint64_t parts;
+        uint64_t next = 0; // first part not yet handed out
+        uint64_t done = 0;
+        std::exception_ptr error;
+    };
+public:
+    typedef std::shared_ptr<job_state> job;
+
+    worker_pool(uint32_t threads) : stopping(false)
+    {
+        for(uint32_t t = 0; t < threads; t++) {
+            this->threads.emplace_back([this] { this->work_loop(); });
+        }
+    } // worker pool constructor
+
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->changed.notify_all();
+        for(std::thread& thread : this->threads) { thread.join(); }
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    /*
+     * queues work(part) for every part in [0, parts). whatever work refers
+     * to has to outlive the matching wait().
+     */
+    template <typename F>
+    job start(uint64_t parts, F work)
+    {
+        job curr = std::make_shared<job_state>();
+        curr->work = work;
+        curr->parts = parts;
+        if(parts == 0) { return curr; }
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->queue.push_back(curr);
+        }
+        this->changed.notify_all();
+        return curr;
+    }
+
+    void wait(const job& curr)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while(curr->done < curr->parts) {
+            if(!this->run_one(guard)) { this->changed.wait(guard); }
+        }
+        if(curr->error) { std::rethrow_exception(curr->error); }
+    }
+
+    template <typename F>
+    void run(uint64_t parts, F work)
+    {
+        this->wait(this->start(parts, work));
+    }
+
+    uint32_t size() { return static_cast<uint32_t>(this->threads.size()); }
+private:
+    std::mutex lock; // guards queue, stopping and every job's counters
+    std::condition_variable changed; // work queued, job finished or stopping
+    std::deque<job> queue; // jobs with parts not yet handed out
+    bool stopping;
+    std::vector<std::thread> threads;
+
+    /* runs one queued part with the lock released, false if none is left */
+    bool run_one(std::unique_lock<std::mutex>& guard)
+    {
+        if(this->queue.empty()) { return false; }
+        job curr = this->queue.front();
+        uint64_t part = curr->next++;
+        if(curr->next == curr->parts) { this->queue.pop_front(); }
+
+        guard.unlock();
+        std::exception_ptr error;
+        try {
+            curr->work(part);
+        }
+        catch(...) {
+            error = std::current_exception();
+        }
+        guard.lock();
+
+        if(error && !curr->error) { curr->error = error; }
+        if(++curr->done == curr->parts) { this->changed.notify_all(); }
+        return true;
+    }
+
+    void work_loop()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while(true) {
+            if(this->run_one(guard)) { continue; }
+            if(this->stopping) { return; }
+            this->changed.wait(guard);
+        }
+    }
+};
+
+/*
+ * holds each of count threads in wait() until all count have arrived, then
+ * releases them together and is ready for the next round.
+ */
+class worker_barrier {
+public:
+    worker_barrier(uint32_t count) : count(count), waiting(0), generation(0)
+    {} // worker barrier constructor
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        uint64_t round = this->generation;
+        if(++this->waiting == this->count) {
+            this->waiting = 0;
+            this->generation++;
+            this->released.notify_all();
+            return;
+        }
+        this->released.wait(guard,
+                            [&] { return this->generation != round; });
+    }
+private:
+    std::mutex lock;
+    std::condition_variable released;
+    uint32_t count;
+    uint32_t waiting;
+    uint64_t generation; // rounds completed, tells a new round from the last
+};
+
+#endif // WORKER_POOL_H
@@ -0,0 +1 @@
+#include "content_store.h"
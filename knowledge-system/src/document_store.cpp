@@ -0,0 +1 @@
+#include "document_store.h"
@@ -0,0 +1 @@
+#include "fulltext.h"
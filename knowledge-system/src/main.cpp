@@ -1,6 +1,17 @@
 #include "sys.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "fulltext.h"
+#include "content_store.h"
+#include "document_store.h"
+#include "tag_index.h"
+#include "rank.h"
+#include "worker_pool.h"
+#include <atomic>
 #include <iostream>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
 
 int main()
 {
@@ -33,7 +44,7 @@ int main()
         tree.insert(doc);
         pq.add_new_task(doc);
         
-        for (const std::string& t : doc->tags) {
+        for (uint32_t t : doc->tags) {
             tags_map.insert(t, doc);
         }
     }
@@ -53,6 +64,18 @@ int main()
     }
     std::cout << "Removed 25 documents. Tree rebalanced." << std::endl;
 
+    // Batched lookups must agree with single finds, hits and misses alike
+    std::vector<uint64_t> batch_ids;
+    for (int i = 99; i >= 0; --i) batch_ids.push_back(i);
+    std::vector<document*> batch_hits = tree.find_batch(batch_ids);
+    int batch_found = 0;
+    for (size_t i = 0; i < batch_ids.size(); ++i) {
+        assert(batch_hits[i] == tree.find(batch_ids[i]));
+        if (batch_hits[i]) batch_found++;
+    }
+    assert(batch_found == NUM_DOCS - 25);
+    std::cout << "find_batch located the same " << batch_found << " documents in one pass." << std::endl;
+
     // 3. HASH TABLE COLLISION TEST
     std::cout << "\n--- PHASE 3: Hash Table Collision Integrity ---" << std::endl;
     std::vector<document*> high_p = tags_map.search("high_priority");
@@ -63,6 +86,11 @@ int main()
     assert(missing.empty());
     std::cout << "Verified: Search for non-existent tags returns empty vector." << std::endl;
 
+    // Every doc shares the same three tags, so only three strings are stored
+    assert(tag_interner::global().size() == 3);
+    assert(all_docs[0]->tag_name(0) == "all_docs");
+    std::cout << "Verified: " << tag_interner::global().size() << " distinct tags interned for " << NUM_DOCS << " documents." << std::endl;
+
     // 4. PRIORITY QUEUE EXTRACTION
     std::cout << "\n--- PHASE 4: Min-Heap Extraction Order ---" << std::endl;
     uint8_t last_prio = 0;
@@ -76,6 +104,31 @@ int main()
     std::cout << "Heap Extraction " << (order_correct ? "[SUCCESS]" : "[FAILURE]") 
               << ": All tasks processed in non-decreasing priority order." << std::endl;
 
+    // Tasks leave from the middle of the heap by their slot, not by a scan
+    {
+        priority_queue slotted;
+        for (int i = 0; i < 20; ++i) slotted.add_new_task(all_docs[i]);
+        bool twice = false;
+        try { slotted.add_new_task(all_docs[3]); } catch (const std::logic_error&) { twice = true; }
+        assert(twice);
+        std::vector<document*> removed;
+        for (int i = 0; i < 20; i += 3) {
+            assert(slotted.remove(all_docs[i]));
+            removed.push_back(all_docs[i]);
+        }
+        assert(!slotted.remove(all_docs[0]));
+        int left = 0;
+        uint8_t prev = 0;
+        while (document* task = slotted.get_next_task()) {
+            bool gone = std::find(removed.begin(), removed.end(), task) != removed.end();
+            assert(task->priority >= prev && !gone);
+            prev = task->priority;
+            left++;
+        }
+        assert(left == 13);
+        std::cout << "Removed 7 tasks from the middle of a 20 task heap." << std::endl;
+    }
+
     // 5. KNOWLEDGE GRAPH: THE CYCLE & REACHABILITY TEST
     std::cout << "\n--- PHASE 5: Graph Reachability & Cycle Handling ---" << std::endl;
     /* Create a complex path: 500 -> 501 -> 502 -> 500 (Cycle)
@@ -89,6 +142,501 @@ int main()
     std::cout << "Path 500 -> 503 reachable? " << (graph.is_reachable(500, 503) ? "YES (Correct)" : "NO (Error)") << std::endl;
     std::cout << "Path 503 -> 500 reachable? " << (graph.is_reachable(503, 500) ? "YES (Error)" : "NO (Correct)") << std::endl;
     std::cout << "Path 500 -> 500 (Self) reachable? " << (graph.is_reachable(500, 500) ? "YES (Correct)" : "NO (Error)") << std::endl;
+    std::cout << "Path 501 -> 599 (Unknown) reachable? " << (graph.is_reachable(501, 599) ? "YES (Error)" : "NO (Correct)") << std::endl;
+
+    // Backlinks walk the reverse edges: 500 is referenced only by 502
+    std::vector<uint64_t> back = graph.get_backlinks(500);
+    assert(back.size() == 1 && back[0] == 502);
+    assert(graph.get_backlinks(503).size() == 1);
+    assert(graph.get_backlinks(599).empty());
+    std::cout << "Verified: Backlinks of 500 -> { " << back[0] << " }." << std::endl;
+
+    // 6. SNAPSHOT ROUND TRIP
+    std::cout << "\n--- PHASE 6: Memory-Mapped Snapshot ---" << std::endl;
+    // The heap was drained above, queue the surviving documents again
+    tree.for_each([&](document* doc) { pq.add_new_task(doc); });
+
+    const std::string snap_path = "snapshot.bin";
+    snapshot_writer().write(snap_path, tree, tags_map, pq, graph);
+    {
+        snapshot snap(snap_path);
+        assert(snap.verify());
+
+        int snap_found = 0;
+        for (int i = 0; i < 100; ++i) {
+            snapshot::doc_view view;
+            bool in_snap = snap.find(i, view);
+            assert(in_snap == (tree.find(i) != nullptr));
+            if (in_snap) {
+                assert(view.content == tree.find(i)->content);
+                snap_found++;
+            }
+        }
+        // The hash table still holds the removed documents, the snapshot must not
+        size_t live_high = 0;
+        for (document* d : tags_map.search("high_priority")) live_high += tree.find(d->id) == d;
+        assert(live_high < tags_map.search("high_priority").size());
+        assert(snap.search("high_priority").size() == live_high);
+        for (auto& view : snap.search("all_docs")) {
+            snapshot::doc_view same;
+            bool found = snap.find(view.id, same);
+            assert(found);
+        }
+        assert(snap.search("does_not_exist").empty());
+
+        snapshot::doc_view next;
+        bool peeked = snap.peek_next_task(next);
+        document* top = pq.get_next_task();
+        assert(peeked && next.priority == top->priority);
+
+        assert(snap.is_reachable(500, 503) && !snap.is_reachable(503, 500));
+        assert(snap.get_backlinks(500) == graph.get_backlinks(500));
+        std::cout << "Snapshot serves " << snap_found << " documents by ID straight from the mapping." << std::endl;
+
+        // Re-snapshotting swaps the file in whole, the open mapping keeps the old one
+        document* moved = tree.remove(next.id);
+        snapshot_writer().write(snap_path, tree, tags_map, pq, graph);
+        snapshot::doc_view old_view;
+        bool still_there = snap.find(next.id, old_view);
+        assert(still_there && old_view.id == next.id);
+        snapshot fresh(snap_path);
+        bool gone = fresh.verify() && !fresh.find(next.id, old_view);
+        assert(gone && fresh.document_count() == snap.document_count() - 1);
+        bool fresh_peeked = fresh.peek_next_task(old_view);
+        assert(fresh_peeked && old_view.id != next.id);
+        tree.insert(moved);
+        std::cout << "Rewrote the snapshot underneath a live mapping." << std::endl;
+    }
+    {
+        // A heap entry past the document table is refused at load, not on first use
+        std::fstream file(snap_path, std::ios::in | std::ios::out | std::ios::binary);
+        snapshot_section heap;
+        file.seekg(sizeof(snapshot_header) + SEC_HEAP * sizeof(snapshot_section));
+        file.read(reinterpret_cast<char*>(&heap), sizeof(heap));
+        assert(file && heap.length >= sizeof(uint32_t));
+        uint32_t past_end = UINT32_MAX;
+        file.seekp(heap.offset);
+        file.write(reinterpret_cast<const char*>(&past_end), sizeof(past_end));
+        file.close();
+        bool refused = false;
+        try {
+            snapshot broken(snap_path);
+        } catch (const std::runtime_error& e) {
+            refused = std::string(e.what()) == "ERR: CORRUPT SNAPSHOT.";
+        }
+        assert(refused);
+        std::cout << "Refused a snapshot whose heap points past its documents." << std::endl;
+    }
+    std::remove(snap_path.c_str());
+
+    // 7. WRITE-AHEAD LOG RECOVERY
+    std::cout << "\n--- PHASE 7: Write-Ahead Log Recovery ---" << std::endl;
+    const std::string wal_path = "wal.log";
+    std::remove(wal_path.c_str());
+    {
+        wal_writer wal(wal_path, wal_sync::group);
+        for (int i = 0; i < 10; ++i) {
+            wal.log_insert(all_docs[i]);
+            wal.log_push(all_docs[i]->id);
+            for (uint32_t t = 0; t < all_docs[i]->tags.size(); ++t) {
+                wal.log_tag(all_docs[i]->tag_name(t), all_docs[i]->id);
+            }
+        }
+        wal.log_remove(all_docs[0]->id);
+        wal.log_pop();
+        wal.log_reference(500, 501);
+        wal.log_reference(501, 502);
+        wal.commit();
+    }
+    {
+        // A crash halfway through a record leaves a torn tail behind
+        std::ofstream torn(wal_path, std::ios::binary | std::ios::app);
+        torn.write("\x40\x00\x00\x00garbage", 11);
+    }
+
+    avl_tree wal_tree;
+    hash_table wal_tags;
+    priority_queue wal_pq;
+    knowledge_graph wal_graph;
+    std::vector<document*> recovered =
+        wal_reader().recover(wal_path, wal_tree, wal_tags, wal_pq, wal_graph);
+    assert(recovered.size() == 10);
+    assert(wal_tree.find(all_docs[0]->id) == nullptr);
+    assert(wal_tree.find(all_docs[1]->id)->content == all_docs[1]->content);
+    assert(wal_graph.is_reachable(500, 502));
+
+    // One of the ten queued tasks was popped before the crash
+    int tasks_left = 0;
+    while (wal_pq.get_next_task()) tasks_left++;
+    assert(tasks_left == 9);
+    assert(wal_tags.search("all_docs").size() == 10);
+
+    // The torn tail is gone, so a second recovery sees the same log
+    avl_tree again_tree;
+    hash_table again_tags;
+    priority_queue again_pq;
+    knowledge_graph again_graph;
+    std::vector<document*> again =
+        wal_reader().recover(wal_path, again_tree, again_tags, again_pq, again_graph);
+    assert(again.size() == recovered.size());
+    std::cout << "Recovered " << recovered.size() << " documents and cut off the torn tail." << std::endl;
+    for (auto d : recovered) delete d;
+    for (auto d : again) delete d;
+    std::remove(wal_path.c_str());
+
+    // A failed write is reported to the caller and sticks, it never counts as durable
+    {
+        wal_writer full("/dev/full", wal_sync::group);
+        full.log_pop();
+        bool commit_failed = false, log_failed = false;
+        try { full.commit(); } catch (const std::runtime_error&) { commit_failed = true; }
+        try { full.log_pop(); } catch (const std::runtime_error&) { log_failed = true; }
+        assert(commit_failed && log_failed);
+        std::cout << "A full disk surfaces as an error from commit() and every later append." << std::endl;
+    }
+
+    // A record naming a document the log never inserted fails the whole recovery
+    {
+        wal_writer wal(wal_path, wal_sync::group);
+        wal.log_insert(all_docs[1]);
+        wal.log_tag("orphan", 777777);
+        wal.commit();
+    }
+    {
+        avl_tree bad_tree;
+        hash_table bad_tags;
+        priority_queue bad_pq;
+        knowledge_graph bad_graph;
+        bool unknown = false;
+        try {
+            wal_reader().recover(wal_path, bad_tree, bad_tags, bad_pq, bad_graph);
+        } catch (const std::logic_error&) { unknown = true; }
+        assert(unknown && bad_tree.find(all_docs[1]->id) == nullptr);
+        std::cout << "A record for an unknown document aborts recovery before any replay." << std::endl;
+    }
+    std::remove(wal_path.c_str());
+
+    // 8. FULL-TEXT SEARCH
+    std::cout << "\n--- PHASE 8: Full-Text BM25 Search ---" << std::endl;
+    fulltext_index text_index;
+    for (auto d : all_docs) text_index.add(d);
+
+    // Every doc shares "content for document", only the id token is rare
+    std::vector<fulltext_index::hit> hits = text_index.search("Document 17", 3);
+    assert(hits.size() == 3);
+    assert(hits[0].doc->id == 17);
+    assert(hits[0].score > hits[1].score && hits[1].score >= hits[2].score);
+    assert(text_index.search("does_not_exist", 3).empty());
+
+    text_index.remove(hits[0].doc);
+    assert(text_index.search("17", 3).empty());
+    assert(text_index.search("content", 100).size() == NUM_DOCS - 1);
+    std::cout << "Top hit for 'document 17' scored " << hits[0].score << ", removed docs stay hidden." << std::endl;
+
+    // 9. DEDUPLICATED, COMPRESSED CONTENT
+    std::cout << "\n--- PHASE 9: Content Store ---" << std::endl;
+    content_store store(256);
+    std::vector<std::string> originals;
+    for (auto d : all_docs) {
+        originals.push_back(d->content);
+        store.compact(d);
+        assert(d->content.empty());
+    }
+    // A repeated body is stored once and handed the same handle
+    assert(store.put(originals[3]) == all_docs[3]->content_handle);
+    bool contents_match = true;
+    for (int i = 0; i < NUM_DOCS; ++i) {
+        contents_match = contents_match && store.content_of(all_docs[i]) == originals[i];
+    }
+    assert(contents_match);
+    assert(store.get_stored_bytes() < store.get_logical_bytes());
+    std::cout << "Stored " << store.get_logical_bytes() << " content bytes in " << store.get_stored_bytes() << " bytes." << std::endl;
+    store.display(all_docs[NUM_DOCS - 1]);
+
+    // Released bodies stop deduplicating, and a block goes once all of its bodies do
+    {
+        content_store scratch(64);
+        document first(1, std::string(40, 'a')), twin(2, std::string(40, 'a')), other(3, std::string(40, 'b'));
+        scratch.compact(&first);
+        scratch.compact(&twin);
+        scratch.compact(&other); // seals the block holding both bodies
+        uint32_t shared = first.content_handle;
+        assert(twin.content_handle == shared);
+        uint64_t sealed_bytes = scratch.get_stored_bytes();
+        scratch.release(&first);
+        assert(first.content_handle == document::inline_content);
+        assert(scratch.content_of(&twin) == std::string(40, 'a'));
+        assert(scratch.get_stored_bytes() == sealed_bytes);
+        scratch.release(&twin);
+        assert(scratch.get_stored_bytes() == sealed_bytes); // other still lives there
+        scratch.release(&other);
+        assert(scratch.get_stored_bytes() == 0);
+        bool released = false;
+        try { scratch.get(shared); } catch (const std::logic_error&) { released = true; }
+        assert(released);
+        assert(scratch.put(std::string(40, 'a')) != shared);
+        std::cout << "Releasing every body of a block freed the block." << std::endl;
+    }
+
+    // Compacted documents refuse to show or index the empty string left behind
+    {
+        bool shown = true, indexed = true, no_cache = false;
+        try { all_docs[0]->display(); } catch (const std::logic_error&) { shown = false; }
+        fulltext_index compacted_text;
+        try { compacted_text.add(all_docs[0]); } catch (const std::logic_error&) { indexed = false; }
+        assert(!shown && !indexed);
+        compacted_text.add(all_docs[0], &store);
+        assert(compacted_text.search("document 0", 1).size() == 1);
+        try { content_store uncached(64, 0); } catch (const std::logic_error&) { no_cache = true; }
+        assert(no_cache);
+        std::cout << "Compacted bodies are displayed and indexed only through their store." << std::endl;
+    }
+
+    // Compacted bodies are read back through the store, never written out empty
+    {
+        bool refused = false;
+        try { snapshot_writer().write(snap_path, tree, tags_map, pq, graph); }
+        catch (const std::logic_error&) { refused = true; }
+        assert(refused);
+        snapshot_writer().write(snap_path, tree, tags_map, pq, graph, &store);
+        snapshot snap(snap_path);
+        bool bodies_match = snap.verify();
+        for (int i = 0; i < NUM_DOCS; ++i) {
+            snapshot::doc_view view;
+            if (snap.find(all_docs[i]->id, view)) bodies_match = bodies_match && view.content == originals[i];
+        }
+        assert(bodies_match);
+
+        wal_writer wal(wal_path, wal_sync::group);
+        wal.log_insert(all_docs[5], &store);
+        wal.commit();
+    }
+    {
+        avl_tree body_tree;
+        hash_table body_tags;
+        priority_queue body_pq;
+        knowledge_graph body_graph;
+        std::vector<document*> bodies =
+            wal_reader().recover(wal_path, body_tree, body_tags, body_pq, body_graph);
+        assert(bodies.size() == 1 && bodies[0]->content == originals[5]);
+        for (auto d : bodies) delete d;
+    }
+    std::remove(snap_path.c_str());
+    std::remove(wal_path.c_str());
+    std::cout << "Snapshot and log carry the full body of compacted documents." << std::endl;
+
+    // 10. UNIFIED DOCUMENT STORE
+    std::cout << "\n--- PHASE 10: Document Store Batch Ingest ---" << std::endl;
+    {
+        document_store docs_store;
+        std::vector<std::vector<document_store::raw_document>> batches(4);
+        for (int i = 0; i < NUM_DOCS; ++i) {
+            uint64_t id = 1000 + i;
+            document_store::raw_document raw;
+            raw.id = id;
+            raw.priority = (i * 7) % 20;
+            raw.content = "Content for document " + std::to_string(id);
+            raw.tags.push_back("all_docs");
+            if (id % 2 == 0) raw.tags.push_back("even_id");
+            if (i > 0) raw.refs.push_back(id - 1); // a chain 1049 -> ... -> 1000
+            batches[i % 4].push_back(raw);
+        }
+        docs_store.ingest(batches);
+        assert(docs_store.size() == NUM_DOCS);
+        assert(docs_store.is_reachable(1049, 1000));
+        assert(docs_store.search_text("1017", 5).size() == 1);
+
+        // A batch that reuses an existing id is rejected as a whole
+        std::vector<document_store::raw_document> clashing(2);
+        clashing[0].id = 2000;
+        clashing[1].id = 1001;
+        bool rejected = false;
+        try { docs_store.ingest(clashing); } catch (const std::logic_error&) { rejected = true; }
+        assert(rejected && docs_store.find(2000) == nullptr);
+
+        // Removing a document takes it out of every index at once
+        assert(docs_store.remove(1017));
+        assert(docs_store.find(1017) == nullptr);
+        assert(docs_store.search_tag("all_docs").size() == NUM_DOCS - 1);
+        assert(docs_store.search_text("1017", 5).empty());
+        assert(!docs_store.is_reachable(1049, 1000));
+        assert(docs_store.get_backlinks(1016).empty());
+
+        int queued = 0;
+        while (document* task = docs_store.get_next_task()) {
+            assert(task->id != 1017);
+            queued++;
+        }
+        assert(queued == NUM_DOCS - 1);
+        assert(docs_store.content_of(docs_store.find(1042)) == "Content for document 1042");
+        std::cout << "Ingested " << NUM_DOCS << " documents in 4 batches, removals stay consistent." << std::endl;
+
+        // Single inserts run on the same pool, and a removed body can be stored again
+        for (int i = 0; i < 100; ++i) {
+            document_store::raw_document raw;
+            raw.id = 3000 + i;
+            raw.content = "Content for document " + std::to_string(raw.id);
+            docs_store.insert(raw);
+        }
+        assert(docs_store.remove(3042));
+        document_store::raw_document again;
+        again.id = 3042;
+        again.content = "Content for document 3042";
+        docs_store.insert(again);
+        assert(docs_store.content_of(docs_store.find(3042)) == again.content);
+        assert(docs_store.size() == NUM_DOCS - 1 + 100);
+    }
+    {
+        // More workers than cores still split tags and edges without losing any
+        document_store wide(5);
+        std::vector<document_store::raw_document> batch;
+        for (int i = 0; i < NUM_DOCS; ++i) {
+            document_store::raw_document raw;
+            raw.id = 5000 + i;
+            raw.content = "Content for document " + std::to_string(raw.id);
+            raw.tags.push_back(i % 2 ? "odd_wide" : "even_wide");
+            raw.refs.push_back(5000 + (i * 7) % NUM_DOCS);
+            raw.refs.push_back(5000 + (i + 1) % NUM_DOCS);
+            batch.push_back(raw);
+        }
+        wide.ingest(batch);
+        assert(wide.search_tag("odd_wide").size() == NUM_DOCS / 2);
+        bool backlinks_match = true;
+        for (int i = 0; i < NUM_DOCS; ++i) {
+            std::vector<uint64_t> want;
+            for (int j = 0; j < NUM_DOCS; ++j) {
+                if (5000 + (j * 7) % NUM_DOCS == 5000 + i) want.push_back(5000 + j);
+                if (5000 + (j + 1) % NUM_DOCS == 5000 + i) want.push_back(5000 + j);
+            }
+            std::vector<uint64_t> got = wide.get_backlinks(5000 + i);
+            std::sort(want.begin(), want.end());
+            std::sort(got.begin(), got.end());
+            backlinks_match = backlinks_match && got == want;
+        }
+        assert(backlinks_match && wide.is_reachable(5000, 5000 + NUM_DOCS - 1));
+        std::cout << "Five publish workers split the tag shards and graph buckets." << std::endl;
+    }
+    {
+        // A part that throws reaches the waiter, the other parts still run
+        worker_pool pool(2), inline_pool(0);
+        std::atomic<int> ran(0);
+        bool thrown = false;
+        try {
+            pool.run(8, [&](uint64_t part) {
+                ran++;
+                if (part == 3) throw std::runtime_error("ERR: PART FAILED.");
+            });
+        } catch (const std::runtime_error&) { thrown = true; }
+        assert(thrown && ran == 8);
+        inline_pool.run(5, [&](uint64_t) { ran++; });
+        assert(ran == 13 && inline_pool.size() == 0);
+        std::cout << "Worker pool ran " << ran << " parts and reported the failing one." << std::endl;
+    }
+
+    // 11. SHARDED TAG INDEX
+    std::cout << "\n--- PHASE 11: Sharded Tag Index ---" << std::endl;
+    {
+        tag_index sharded(6); // rounded up to 8 shards
+        assert(sharded.shard_count() == 8);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&, t] {
+                for (int i = t; i < NUM_DOCS; i += 4) sharded.insert(all_docs[i]);
+            });
+        }
+        for (auto& w : writers) w.join();
+        assert(sharded.search("all_docs").size() == NUM_DOCS);
+        assert(sharded.search("even_id").size() == tags_map.search("even_id").size());
+        assert(sharded.search("never_seen").empty());
+
+        sharded.remove(tag_interner::global().intern("all_docs"), all_docs[3]);
+        assert(sharded.count(tag_interner::global().intern("all_docs")) == NUM_DOCS - 1);
+        uint64_t pairs = 0, expected = 0;
+        sharded.for_each([&](uint32_t, document*) { pairs++; });
+        for (auto d : all_docs) expected += d->tags.size();
+        assert(pairs == expected - 1);
+        std::cout << "4 writers filled " << sharded.shard_count() << " shards, postings match the hash table." << std::endl;
+
+        // Postings span several chunks and keep insertion order through removals
+        uint32_t many = tag_interner::global().intern("many_chunks");
+        for (int round = 0; round < 30; ++round) {
+            for (auto d : all_docs) sharded.insert(many, d);
+        }
+        for (int i = 0; i < 10; ++i) sharded.remove(many, all_docs[i]);
+        std::vector<document*> kept = sharded.search(many);
+        assert(kept.size() == 30 * (NUM_DOCS - 10));
+        for (size_t i = 0; i < kept.size(); ++i) assert(kept[i] == all_docs[10 + i % (NUM_DOCS - 10)]);
+        for (int i = 10; i < NUM_DOCS; ++i) sharded.remove(many, all_docs[i]);
+        assert(sharded.count(many) == 0);
+        sharded.insert(many, all_docs[0]);
+        assert(sharded.search(many) == std::vector<document*>{all_docs[0]});
+    }
+
+    // 12. PAGERANK
+    std::cout << "\n--- PHASE 12: Reference Graph Ranking ---" << std::endl;
+    {
+        // 50 documents each cite the one before, and every tenth cites hub 7000
+        knowledge_graph cites;
+        for (int i = 1; i < NUM_DOCS; ++i) {
+            cites.add_reference(6000 + i, 6000 + i - 1);
+            if (i % 10 == 0) cites.add_reference(6000 + i, 7000);
+        }
+        page_rank serial(1), parallel(4);
+        uint32_t full_passes = serial.compute(cites);
+        parallel.compute(cites);
+        assert(serial.size() == NUM_DOCS + 1 && serial.edge_count() == NUM_DOCS + 3);
+        assert(serial.get_delta() < 1e-9);
+
+        double total = 0;
+        for (auto& entry : serial.top(NUM_DOCS + 1)) {
+            total += entry.second;
+            assert(std::fabs(entry.second - parallel.rank_of(entry.first)) < 1e-12);
+        }
+        assert(std::fabs(total - 1) < 1e-9);
+        assert(serial.top(1)[0].first == 7000);
+        assert(serial.rank_of(6000) > serial.rank_of(6049)); // rank flows down the chain
+        assert(serial.rank_of(12345) == 0);
+
+        // A batch of new citations only pushes through the part of the graph it reaches
+        std::vector<std::pair<uint64_t, uint64_t>> batch;
+        for (int i = 0; i < 5; ++i) batch.push_back(std::make_pair(7100 + i, 7000));
+        batch.push_back(std::make_pair(6049, 7000)); // an old source gains a target
+        batch.push_back(std::make_pair(7000, 7200)); // the hub stops dangling
+        for (auto& edge : batch) cites.add_reference(edge.first, edge.second);
+        uint64_t pushes = serial.update(batch);
+        page_rank fresh(1);
+        fresh.compute(cites);
+        assert(serial.size() == fresh.size() && serial.edge_count() == fresh.edge_count());
+        for (auto& entry : fresh.top(fresh.size())) {
+            assert(std::fabs(entry.second - serial.rank_of(entry.first)) < 1e-8);
+        }
+        // Nothing reaches the chain below 6049 except through 6049 itself
+        assert(pushes > 0 && pushes < 4 * fresh.size());
+
+        // A citation between two new documents touches those two and nothing else
+        std::vector<std::pair<uint64_t, uint64_t>> apart(1, std::make_pair(8000, 8001));
+        cites.add_reference(8000, 8001);
+        assert(serial.update(apart) == 2);
+        page_rank again(1);
+        again.compute(cites);
+        for (auto& entry : again.top(again.size())) {
+            assert(std::fabs(entry.second - serial.rank_of(entry.first)) < 1e-8);
+        }
+        std::cout << "Ranked " << serial.size() << " documents in " << full_passes << " passes, folded in a batch of "
+                  << batch.size() << " citations with " << pushes << " pushes." << std::endl;
+    }
+
+    // 13. HOT-PATH STATS
+    std::cout << "\n--- PHASE 13: Stats Surface ---" << std::endl;
+    std::string stats = ks_stats::global().json();
+#ifndef KS_NO_STATS
+    assert(stats.find("\"avl_tree.insert\": {\"count\": ") != std::string::npos);
+    assert(stats.find("\"knowledge_graph.is_reachable\"") != std::string::npos);
+    assert(stats.find("\"avl_tree.rotations\": 0,") == std::string::npos);
+#endif
+    std::cout << stats << std::endl;
+    ks_stats::global().reset();
+    assert(ks_stats::global().json().find("\"avl_tree.insert\"") == std::string::npos);
 
     // Cleanup
     for (auto d : all_docs) delete d;
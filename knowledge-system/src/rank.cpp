@@ -0,0 +1 @@
+#include "rank.h"
@@ -0,0 +1 @@
+#include "snapshot.h"
@@ -0,0 +1 @@
+#include "tag_index.h"
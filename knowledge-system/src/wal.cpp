@@ -0,0 +1 @@
+#include "wal.h"
@@ -0,0 +1 @@
+#include "worker_pool.h"